@@ -0,0 +1,68 @@
+#!/bin/bash
+
+# Scaling benchmark: links generated inputs of increasing module count and
+# reports the pass1/pass2 times printed by the linker's -T option.
+# A linear pass1 shows up as a roughly constant time per module.
+
+usage() {
+    [[ "${1}" == "" ]] || echo "${1}"
+    echo "usage: $0 <linker+optionalargs>"
+    echo "  LADDER=\"16 32 ...\"  module counts to link (default: ${LADDER})"
+    echo "  DEFS=n              symbols defined per module (default: ${DEFS})"
+    echo "  INSTR=n             instructions per module (default: ${INSTR})"
+    echo "  REPEAT=n            runs per size, best time kept (default: ${REPEAT})"
+    echo "beyond the default 128-module machine, pass a larger profile, e.g."
+    echo "  LADDER=\"1000 2000 4000 8000\" $0 ./fixed_linker --max-modules 10000 --machine-size 100000"
+    exit
+}
+
+LADDER=${LADDER:-"8 16 32 64 128"}
+DEFS=${DEFS:-16}
+INSTR=${INSTR:-4}
+REPEAT=${REPEAT:-5}
+
+[[ ${#} -lt 1 ]] && usage ""
+PROG=${1}
+shift 1
+LINKER="${PROG} $*"
+
+[[ ! -x ${PROG} ]] && echo "program <$PROG> is not executable" && exit
+
+TMPDIR=$(mktemp -d)
+trap "rm -rf ${TMPDIR}" EXIT
+
+# every module defines DEFS symbols, uses one symbol of the previous module
+# and references it from each of its INSTR instructions
+generate() {
+    awk -v mods=${1} -v defs=${DEFS} -v instr=${INSTR} 'BEGIN {
+        for (m = 0; m < mods; m++) {
+            line = defs
+            for (d = 0; d < defs; d++) line = line " m" m "s" d " " (d % (instr > 0 ? instr : 1))
+            print line
+            print "1 m" (m > 0 ? m - 1 : mods - 1) "s0"
+            line = instr
+            for (i = 0; i < instr; i++) line = line " E 1000"
+            print line
+        }
+    }'
+}
+
+echo "linker=<$LINKER> defs/module=${DEFS} instr/module=${INSTR}"
+printf "%10s %10s %12s %12s %12s\n" modules symbols pass1_ms pass2_ms us/module
+
+for mods in ${LADDER}; do
+    INPUT=${TMPDIR}/input-${mods}
+    generate ${mods} > ${INPUT}
+
+    best1="" ; best2=""
+    for r in $(seq 1 ${REPEAT}); do
+        read t1 t2 < <(${LINKER} -T ${INPUT} 2>&1 >/dev/null |
+                       awk '/^pass1:/ {p1=$2} /^pass2:/ {p2=$2} END {print p1, p2}')
+        [[ "${t1}" == "" ]] && echo "link of ${mods} modules failed" && exit 1
+        if [[ "${best1}" == "" ]] || awk "BEGIN {exit !(${t1} < ${best1})}"; then best1=${t1}; fi
+        if [[ "${best2}" == "" ]] || awk "BEGIN {exit !(${t2} < ${best2})}"; then best2=${t2}; fi
+    done
+
+    awk -v m=${mods} -v d=${DEFS} -v t1=${best1} -v t2=${best2} \
+        'BEGIN { printf "%10d %10d %12.3f %12.3f %12.3f\n", m, m * d, t1, t2, t1 * 1000 / m }'
+done
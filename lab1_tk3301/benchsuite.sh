@@ -0,0 +1,67 @@
+#!/bin/bash
+
+# Throughput benchmark: links lab1gen inputs of increasing size and reports the
+# phase times, bytes/sec and tokens/sec over the whole link, and peak RSS, all
+# taken from the linker's -T report. The inputs are generated once with a fixed
+# seed and kept in DATA, so successive linker versions are measured on the same data.
+
+usage() {
+    [[ "${1}" == "" ]] || echo "${1}"
+    echo "usage: $0 <linker+optionalargs>"
+    echo "  SIZES=\"1M 16M ...\"  input sizes to link (default: ${SIZES})"
+    echo "  GEN=\"...\"           lab1gen options besides -S (default: ${GEN})"
+    echo "  DATA=dir            where the generated inputs are kept (default: ${DATA})"
+    echo "  REPEAT=n            runs per size, best time kept (default: ${REPEAT})"
+    echo "e.g. SIZES=\"64M 256M 1G\" GEN=\"-d 16 -u 16 -i 256 -e 0.01\" $0 ./fixed_linker -j 4"
+    exit
+}
+
+SIZES=${SIZES:-"1M 4M 16M 64M"}
+GEN=${GEN:-"-d 8 -u 8 -i 64"}
+DATA=${DATA:-bench-data}
+REPEAT=${REPEAT:-3}
+LAB1GEN=${LAB1GEN:-$(dirname $0)/lab1gen}
+
+[[ ${#} -lt 1 ]] && usage ""
+PROG=${1}
+shift 1
+LINKER="${PROG} $*"
+
+[[ ! -x ${PROG} ]] && echo "program <$PROG> is not executable" && exit
+[[ ! -x ${LAB1GEN} ]] && echo "generator <$LAB1GEN> is not built (make lab1gen)" && exit
+
+mkdir -p ${DATA}
+
+# input-<size> is reused only if it was generated with the same options
+generate() {
+    local input=${DATA}/input-${1}
+    if [[ ! -f ${input} || "$(cat ${input}.gen 2>/dev/null)" != "${GEN}" ]]; then
+        ${LAB1GEN} -S ${1} ${GEN} > ${input} 2> ${input}.err || { cat ${input}.err; exit 1; }
+        echo "${GEN}" > ${input}.gen
+    fi
+    echo ${input}
+}
+
+echo "linker=<$LINKER> lab1gen=<${GEN}>"
+printf "%8s %10s %11s %10s %10s %10s %10s %10s %11s %10s\n" \
+       size modules instr pass1_ms pass2_ms output_ms total_ms MB/s Mtokens/s peakRSS_MB
+
+for size in ${SIZES}; do
+    INPUT=$(generate ${size}) || exit 1
+    PROFILE=$(sed -n 's/^link with: //p' ${INPUT}.err)
+
+    best=""
+    for r in $(seq 1 ${REPEAT}); do
+        line=$(${LINKER} ${PROFILE} -T ${INPUT} 2>&1 >/dev/null |
+               awk '/^pass1:/ {p1=$2; mods=substr($4, 2); instr=$6} /^pass2:/ {p2=$2} /^output:/ {out=$2}
+                    /^throughput:/ {bytes=$2; tokens=$4} /^memory:/ {rss=$2}
+                    END {print p1 + p2 + out, p1, p2, out, mods, instr, bytes, tokens, rss}')
+        [[ "${line}" == "" || "$(echo ${line} | cut -d' ' -f9)" == "" ]] && echo "link of ${INPUT} failed" && exit 1
+        if [[ "${best}" == "" ]] || awk "BEGIN {exit !(${line%% *} < ${best%% *})}"; then best=${line}; fi
+    done
+
+    echo ${best} | awk -v size=${size} '{
+        total = $1; secs = total / 1000
+        printf "%8s %10d %11d %10.1f %10.1f %10.1f %10.1f %10.1f %11.2f %10.1f\n",
+               size, $5, $6, $2, $3, $4, total, $7 / 1048576 / secs, $8 / 1e6 / secs, $9 / 1024 }'
+done
@@ -1,383 +1,407 @@
+#include "linker.h"
+
 #include <iostream>
-#include <fstream>
-#include <string>
-#include <vector>
-#include <map>
 #include <iomanip>
-#include <sstream>
 #include <stdexcept>
-#include <cctype>
-#include <cstring>
-
-const int MACHINE_SIZE = 512;
-const int MAX_SYMBOL_TABLE_SIZE = 256;
-const int MAX_MODULE_TABLE_SIZE = 128;
-
-int linenum = 0;  
-int lineoffset = 0;
-int last_valid_offset = 0;
-int totalInstructions = 0;
-std::ifstream input_file;
-std::string current_line;
-size_t current_pos = 0;
-
-struct Symbol {
-    std::string name;
-    int value;
-    bool isDefined;
-    bool isUsed;
-    int definingModule;
-    std::string errorMessage;
-};
-
-std::map<std::string, Symbol> symbolTable;
-std::vector<int> moduleBaseAddresses;
-std::vector<int> memoryMap;
-std::vector<std::string> warnings;
-
-void __parseerror(int errcode) {
-    static const char* errstr[] = {
-        "NUM_EXPECTED",        // 0
-        "SYM_EXPECTED",        // 1
-        "ADDR_EXPECTED",       // 2
-        "SYM_TOO_LONG",        // 3
-        "TOO_MANY_DEF_IN_MODULE", // 4
-        "TOO_MANY_USE_IN_MODULE", // 5
-        "TOO_MANY_INSTR",      // 6
-        "MARIE_EXPECTED"       // 7
-    };
-    printf("Parse Error line %d offset %d: %s\n", linenum, lineoffset, errstr[errcode]);
-    exit(1);
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+// The profile given on the command line; every link gets a copy
+MachineProfile machine;
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
-std::string getToken() {
-    while (true) {
-        // If we're at the end of the current line or haven't read a line yet
-        if (current_pos >= current_line.length()) {
-            if (!std::getline(input_file, current_line)) {
-                return ""; // EOF
-            }
-            current_line += '\n'; // Add newline for consistent processing
-            linenum++;
-            current_pos = 0;
-            lineoffset = 1; // Reset offset to start of the new line
-        }
-
-        
-        while (current_pos < current_line.length() && std::isspace(current_line[current_pos])) {
-            if (current_line[current_pos] == '\n') {
-                //linenum++;  // Increment the line number
-                lineoffset = current_line.length();
-                current_pos++;
-                //lineoffset = 1; // Reset offset to 1 at the start of the new line
-                continue;
-           }
-            current_pos++;
-            lineoffset++;
-        }
-
-        size_t token_start_pos = current_pos;
+// --batch: links every input on its own Linker, on a pool of jobs threads, and writes each
+// output to outDir/<input name>.out. Returns the number of links that failed.
+size_t runBatch(char* const inputs[], size_t count, const char* outDir, int jobs, const std::vector<int>& gcEntries,
+                double& elapsed) {
+    std::atomic<size_t> nextInput(0);
+    std::atomic<size_t> failed(0);
+
+    auto worker = [&]() {
+        size_t i;
+        while ((i = nextInput++) < count) {
+            const char* path = inputs[i];
+            const char* name = strrchr(path, '/');
+            std::string outPath = std::string(outDir) + "/" + (name ? name + 1 : path) + ".out";
+
+            Linker linker;
+            linker.machine = machine;
+            bool ok = true;
+            std::string error;
+            if (!linker.open(path)) {
+                error = "Error opening file: " + std::string(path) + "\n";
+            } else if (linker.isArchiveInput()) {
+                error = "Error: archives are linked with -l: " + std::string(path) + "\n";
+            } else {
+                try {
+                    linker.pass1();
+                    linker.resolveArchives();
+                    if (!gcEntries.empty()) linker.collectModules(gcEntries);
+                    linker.listing(1);
+                } catch (const ParseError&) {
+                    ok = false;
+                } catch (const std::exception& e) {
+                    ok = false;
+                    error = std::string("An error occurred: ") + e.what() + " (" + path + ")\n";
+                }
 
-        while (current_pos < current_line.length() && !std::isspace(current_line[current_pos])) {
-            current_pos++;
-            
-        }
+                int fd = ::open(outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0) {
+                    error = "Error writing output file: " + outPath + "\n";
+                } else {
+                    linker.out.flush(fd);
+                    close(fd);
+                }
+            }
 
-        if (token_start_pos == current_pos) {
-            continue;
+            if (!error.empty()) {
+                ok = false;
+                std::cerr << error;
+            }
+            if (!ok) failed++;
         }
+    };
 
-        // Extract the token
-        std::string token = current_line.substr(token_start_pos, current_pos - token_start_pos);
-
-        //last_valid_offset = lineoffset;
-        //lineoffset = current_pos + 1;
-        //std::cout<<lineoffset<<std::endl;
-        return token;
-    }
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int id = 1; id < jobs; id++) threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads) t.join();
+    elapsed = elapsedMs(start);
+    return failed;
 }
 
-int readInt() {
-    std::string token = getToken();
-    if (token.empty()) throw std::runtime_error("EOF");
-    try {
-        size_t pos = 0;
-        int value = std::stoi(token, &pos);
-        if (pos != token.length()) __parseerror(0);
-        
-        return value;
-    } catch (const std::invalid_argument&) {
-        __parseerror(0);
-    } catch (const std::out_of_range&) {
-        __parseerror(0);
+// Comma-separated module numbers, e.g. "0,3"
+bool parseModuleList(const char* list, std::vector<int>& modules) {
+    while (true) {
+        char* end;
+        errno = 0;
+        long m = strtol(list, &end, 10);
+        if (end == list || errno != 0 || m < 0 || m > INT_MAX) return false;
+        modules.push_back(m);
+        if (*end == '\0') return true;
+        if (*end != ',') return false;
+        list = end + 1;
     }
-    
-    return 0;
 }
 
-std::string readSymbol() {
-    std::string token = getToken();
-    if (token.empty() || !std::isalpha(token[0])) __parseerror(1);
-    if (token.length() > 16) __parseerror(3);
-    for (char c : token) {
-        if (!std::isalnum(c)) __parseerror(1);
-    }
-    lineoffset = current_pos + 1;
-    return token;
+// A whole decimal number in [min, max]; atoi would take "abc" as 0 and wrap on overflow
+bool parseNumber(const char* text, long min, long max, int& value) {
+    char* end;
+    errno = 0;
+    long n = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0 || n < min || n > max) return false;
+    value = n;
+    return true;
 }
 
-char readMARIE() {
-    std::string token = getToken();
-    if (token.empty() || token.length() != 1 || strchr("MARIE", token[0]) == NULL) {
-        __parseerror(7); // MARIE_EXPECTED
-    }
-    lineoffset = current_pos + 1;
-    return token[0];
+void show_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options] <input_file>\n";
+    std::cerr << "       " << prog << " [options] --batch outdir <input_file>...\n";
+    std::cerr << "  -T: report phase timings, throughput and link counters to stderr\n";
+    std::cerr << "  -l archive: pull in archive members that define otherwise undefined symbols\n";
+    std::cerr << "  -j jobs: relocate modules on this many threads (0: one per core)\n";
+    std::cerr << "  --machine-size n: words of memory (default 512)\n";
+    std::cerr << "  --operand-digits d: decimal digits of the operand field (default 3, up to 17)\n";
+    std::cerr << "  --max-modules n: module table size (default 128)\n";
+    std::cerr << "  --max-defs n: definitions per module (default 16)\n";
+    std::cerr << "  --max-uses n: uselist entries per module (default 16)\n";
+    std::cerr << "  --emit-object file: write the input as a binary object instead of linking it\n";
+    std::cerr << "  --emit-archive file: write the input as an indexed archive instead of linking it\n";
+    std::cerr << "  --cache file: relink incrementally, reusing unchanged modules from this cache\n";
+    std::cerr << "  --batch outdir: link every input, -j at a time, into outdir/<input name>.out\n";
+    std::cerr << "  --gc-modules m,...: link only the modules reachable from these entry modules\n";
+    std::cerr << "  --scan auto|scalar|sse2|avx2: token scanner (default: the widest the CPU supports)\n";
+    std::cerr << "  --stream: link in memory bounded by the symbol table, rereading each module in pass2\n";
+    std::cerr << "Binary objects are recognized by their header and linked without tokenizing.\n";
 }
 
-void pass1() {
-    int moduleCount = 0;
-    totalInstructions = 0;
-
-    while (true) {
-        try {
-            int defCount = readInt();
-            if (defCount > 16) __parseerror(4);
-
-            for (int i = 0; i < defCount; i++) {
-                std::string symbol = readSymbol();
-                int value = readInt();
-
-                if (symbolTable.count(symbol) > 0) {
-                    if (symbolTable[symbol].errorMessage.empty()) {
-                        symbolTable[symbol].errorMessage = "Error: This variable is multiple times defined; first value used";
-                        warnings.push_back("Warning: Module " + std::to_string(moduleCount) + ": " + symbol + " redefinition ignored");
-                    }
-                    continue;
-                }
-
-                if (symbolTable.size() >= MAX_SYMBOL_TABLE_SIZE) {
-                    __parseerror(4);
-                }
-
-                symbolTable[symbol] = {symbol, value + totalInstructions, true, false, moduleCount, ""};
-            }
-
-            int useCount = readInt();
-            if (useCount > 16) __parseerror(5);
-            for (int i = 0; i < useCount; i++) readSymbol();
-
-            int instructionCount = readInt();
-            if (totalInstructions + instructionCount > MACHINE_SIZE) __parseerror(6);
+enum LongOption {
+    OPT_MACHINE_SIZE = 256,
+    OPT_OPERAND_DIGITS,
+    OPT_MAX_MODULES,
+    OPT_MAX_DEFS,
+    OPT_MAX_USES,
+    OPT_EMIT_OBJECT,
+    OPT_EMIT_ARCHIVE,
+    OPT_CACHE,
+    OPT_BATCH,
+    OPT_SCAN,
+    OPT_GC_MODULES,
+    OPT_STREAM
+};
 
-            for (int i = 0; i < instructionCount; i++) {
-                readMARIE();
-                readInt();
-            }
+int main(int argc, char* argv[]) {
+    bool reportTimings = false;
+    int jobs = 1;
+    const char* objectPath = nullptr;
+    const char* archivePath = nullptr;
+    const char* cachePath = nullptr;
+    bool streaming = false;
+    const char* batchDir = nullptr;
+    const char* scanName = "auto";
+    std::vector<int> gcEntries;
+    std::vector<const char*> archivePaths;
+
+    static const struct option longOptions[] = {
+        {"machine-size", required_argument, nullptr, OPT_MACHINE_SIZE},
+        {"operand-digits", required_argument, nullptr, OPT_OPERAND_DIGITS},
+        {"max-modules", required_argument, nullptr, OPT_MAX_MODULES},
+        {"max-defs", required_argument, nullptr, OPT_MAX_DEFS},
+        {"max-uses", required_argument, nullptr, OPT_MAX_USES},
+        {"emit-object", required_argument, nullptr, OPT_EMIT_OBJECT},
+        {"emit-archive", required_argument, nullptr, OPT_EMIT_ARCHIVE},
+        {"cache", required_argument, nullptr, OPT_CACHE},
+        {"batch", required_argument, nullptr, OPT_BATCH},
+        {"scan", required_argument, nullptr, OPT_SCAN},
+        {"gc-modules", required_argument, nullptr, OPT_GC_MODULES},
+        {"stream", no_argument, nullptr, OPT_STREAM},
+        {nullptr, 0, nullptr, 0}
+    };
 
-            for (auto& pair : symbolTable) {
-                if (pair.second.definingModule == moduleCount) {
-                    if (pair.second.value - totalInstructions >= instructionCount) {
-                        warnings.push_back("Warning: Module " + std::to_string(moduleCount) + ": " + pair.first + 
-                                           "=" + std::to_string(pair.second.value - totalInstructions) + 
-                                           " valid=[0.." + std::to_string(instructionCount-1) + "] assume zero relative");
-                        pair.second.value = totalInstructions;
-                    }
+    int c;
+    while ((c = getopt_long(argc, argv, "Tj:l:", longOptions, nullptr)) != -1) {
+        bool valid = true;
+        switch (c) {
+            case 'T':
+                reportTimings = true;
+                break;
+            case 'j':
+                valid = parseNumber(optarg, 0, INT_MAX, jobs);
+                if (jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
+                break;
+            case 'l':
+                archivePaths.push_back(optarg);
+                break;
+            case OPT_MACHINE_SIZE:
+                valid = parseNumber(optarg, 1, INT_MAX, machine.machineSize);
+                break;
+            case OPT_OPERAND_DIGITS:
+                valid = parseNumber(optarg, 3, 17, machine.operandDigits);
+                break;
+            case OPT_MAX_MODULES:
+                valid = parseNumber(optarg, 1, INT_MAX, machine.maxModules);
+                break;
+            case OPT_MAX_DEFS:
+                valid = parseNumber(optarg, 0, INT_MAX, machine.maxDefs);
+                break;
+            case OPT_MAX_USES:
+                valid = parseNumber(optarg, 0, INT_MAX, machine.maxUses);
+                break;
+            case OPT_EMIT_OBJECT:
+                objectPath = optarg;
+                break;
+            case OPT_EMIT_ARCHIVE:
+                archivePath = optarg;
+                break;
+            case OPT_CACHE:
+                cachePath = optarg;
+                break;
+            case OPT_BATCH:
+                batchDir = optarg;
+                break;
+            case OPT_SCAN:
+                scanName = optarg;
+                break;
+            case OPT_GC_MODULES:
+                if (!parseModuleList(optarg, gcEntries)) {
+                    std::cerr << "Error: --gc-modules expects comma-separated module numbers\n";
+                    return 1;
                 }
-            }
-
-            moduleBaseAddresses.push_back(totalInstructions);
-            totalInstructions += instructionCount;
-            moduleCount++;
-
-            if (moduleCount > MAX_MODULE_TABLE_SIZE) {
-                __parseerror(6);
-            }
-        } catch (const std::runtime_error& e) {
-            if (std::string(e.what()) == "EOF") break;
-            throw;
+                break;
+            case OPT_STREAM:
+                streaming = true;
+                break;
+            default:
+                show_usage(argv[0]);
+                return 1;
+        }
+        if (!valid) {
+            std::cerr << "Error: invalid number: " << optarg << "\n";
+            show_usage(argv[0]);
+            return 1;
         }
     }
-}
-
-void pass2() {
-    input_file.clear();
-    input_file.seekg(0);
-    linenum = 1;
-    lineoffset = 0;
-    current_pos = 0;
-    current_line = "";
-
-    int moduleCount = 0;
-    int currentAddress = 0;
 
-    while (true) {
-        try {
-            int defCount = readInt();
-
-            for (int i = 0; i < defCount; i++) {
-                readSymbol();
-                readInt();
-            }
-
-            int useCount = readInt();
-            std::vector<std::string> useList;
-            std::vector<bool> usedSymbols(useCount, false);
-            for (int i = 0; i < useCount; i++) {
-                useList.push_back(readSymbol());
-            }
-
-            int instructionCount = readInt();
-            for (int i = 0; i < instructionCount; i++) {
-                char addressMode = readMARIE();
-                int instruction = readInt();
-                int opcode = instruction / 1000;
-                int operand = instruction % 1000;
-
-                std::stringstream output;
-                output << std::setfill('0') << std::setw(3) << currentAddress << ": ";
+    if (batchDir ? argc - optind < 1 : argc - optind != 1) {
+        show_usage(argv[0]);
+        return 1;
+    }
+    if (batchDir && (objectPath || archivePath || cachePath)) {
+        std::cerr << "Error: --batch links only; it cannot emit objects or archives or use a cache\n";
+        return 1;
+    }
+    if (!gcEntries.empty() && (objectPath || archivePath || cachePath)) {
+        std::cerr << "Error: --gc-modules links only; it cannot emit objects or archives or use a cache\n";
+        return 1;
+    }
+    if (streaming && (objectPath || archivePath || cachePath || batchDir || !gcEntries.empty() ||
+                      !archivePaths.empty())) {
+        std::cerr << "Error: --stream links one text input on its own; it cannot be combined with "
+                     "-l, --gc-modules, --batch, a cache or emitting\n";
+        return 1;
+    }
 
-                if (opcode >= 10) {
-                    output << "9999 Error: Illegal opcode; treated as 9999";
-                    memoryMap.push_back(9999);
-                } else {
-                    switch (addressMode) {
-                        case 'I':
-                            if (operand >= 900) {
-                                output << std::setw(4) << (opcode * 1000 + 999) << " Error: Illegal immediate operand; treated as 999";
-                                memoryMap.push_back(opcode * 1000 + 999);
-                            } else {
-                                output << std::setw(4) << instruction;
-                                memoryMap.push_back(instruction);
-                            }
-                            break;
-                        case 'A':
-                            if (operand >= MACHINE_SIZE) {
-                                output << std::setw(4) << (opcode * 1000) << " Error: Absolute address exceeds machine size; zero used";
-                                memoryMap.push_back(opcode * 1000);
-                            } else {
-                                output << std::setw(4) << instruction;
-                                memoryMap.push_back(instruction);
-                            }
-                            break;
-                        case 'R':
-                            if (operand >= instructionCount) {
-                                output << std::setw(4) << (opcode * 1000 + moduleBaseAddresses[moduleCount])
-                                       << " Error: Relative address exceeds module size; relative zero used";
-                                memoryMap.push_back(opcode * 1000 + moduleBaseAddresses[moduleCount]);
-                            } else {
-                                int absoluteAddress = opcode * 1000 + operand + moduleBaseAddresses[moduleCount];
-                                output << std::setw(4) << absoluteAddress;
-                                memoryMap.push_back(absoluteAddress);
-                            }
-                            break;
-                        case 'E':
-                            if (operand >= useCount) {
-                                output << std::setw(4) << (opcode * 1000)
-                                       << " Error: External operand exceeds length of uselist; treated as relative=0";
-                                memoryMap.push_back(opcode * 1000);
-                            } else {
-                                std::string symbol = useList[operand];
-                                usedSymbols[operand] = true;
-                                if (symbolTable.count(symbol) == 0) {
-                                    output << std::setw(4) << (opcode * 1000)
-                                           << " Error: " << symbol << " is not defined; zero used";
-                                    memoryMap.push_back(opcode * 1000);
-                                } else {
-                                    symbolTable[symbol].isUsed = true;
-                                    int absoluteAddress = opcode * 1000 + symbolTable[symbol].value;
-                                    output << std::setw(4) << absoluteAddress;
-                                    memoryMap.push_back(absoluteAddress);
-                                }
-                            }
-                            break;
-                        case 'M':
-                            if (operand >= moduleBaseAddresses.size()) {
-                                output << std::setw(4) << (opcode * 1000)
-                                       << " Error: Illegal module operand ; treated as module=0";
-                                memoryMap.push_back(opcode * 1000);
-                            } else {
-                                int absoluteAddress = opcode * 1000 + moduleBaseAddresses[operand];
-                                output << std::setw(4) << absoluteAddress;
-                                memoryMap.push_back(absoluteAddress);
-                            }
-                            break;
-                    }
-                }
-                std::cout << output.str() << "\n";
-                currentAddress++;
-            }
+    if (!setupMachine(machine)) {
+        std::cerr << "Error: Invalid machine profile\n";
+        return 1;
+    }
+    if (!selectScanner(scanName)) {
+        std::cerr << "Error: unknown or unsupported scanner: " << scanName << "\n";
+        return 1;
+    }
 
-            for (size_t i = 0; i < useList.size(); i++) {
-                if (!usedSymbols[i]) {
-                    std::cout << "Warning: Module " << moduleCount << ": uselist[" << i << "]=" << useList[i] << " was not used\n";
-                }
+    // Archives only matter when linking; emitting an object or archive keeps just the input
+    if (!objectPath && !archivePath) {
+        archives.resize(archivePaths.size());
+        for (size_t i = 0; i < archivePaths.size(); i++) {
+            if (!openArchive(archivePaths[i], archives[i])) {
+                std::cerr << "Error: not a valid archive: " << archivePaths[i] << "\n";
+                return 1;
             }
-
-            moduleCount++;
-        } catch (const std::runtime_error& e) {
-            if (std::string(e.what()) == "EOF") break;
-            throw;
         }
     }
 
-    std::cout << std::endl;  // Add a blank line after Memory Map
-
-    for (const auto& pair : symbolTable) {
-        if (pair.second.isDefined && !pair.second.isUsed) {
-            warnings.push_back("Warning: Module " + std::to_string(pair.second.definingModule) + ": " + pair.first + " was defined but never used");
-        }
+    if (batchDir) {
+        size_t count = argc - optind;
+        double elapsed;
+        size_t failed = runBatch(argv + optind, count, batchDir, std::min<size_t>(jobs, count), gcEntries, elapsed);
+        std::cerr << std::fixed << std::setprecision(1)
+                  << "batch: " << count << " links (" << failed << " failed) in " << elapsed << " ms, "
+                  << count / (elapsed / 1000) << " links/sec\n";
+        return failed ? 1 : 0;
     }
-}
 
-void printSymbolTable() {
-    std::cout << "Symbol Table\n";
-    for (const auto& pair : symbolTable) {
-        std::cout << pair.first << "=" << pair.second.value;
-        if (!pair.second.errorMessage.empty()) {
-            std::cout << " " << pair.second.errorMessage;
-        }
-        std::cout << "\n";
+    Linker linker;
+    linker.machine = machine;
+    if (!linker.open(argv[optind])) {
+        std::cerr << "Error opening file: " << argv[optind] << "\n";
+        return 1;
+    }
+    if (linker.isArchiveInput()) {
+        std::cerr << "Error: archives are linked with -l: " << argv[optind] << "\n";
+        return 1;
     }
-    std::cout << std::endl;  // Add a blank line after Symbol Table
-}
 
-void printWarnings() {
-    for (const auto& warning : warnings) {
-        std::cout << warning << "\n";
+    // The cache is keyed on source text; an object is already cheap to load
+    if (cachePath && !objectPath && !archivePath && !linker.isObjectInput()) {
+        linker.cacheEnabled = true;
+        jobs = 1;
+        linker.loadCache(cachePath);
     }
-    std::cout << std::endl;  // Add a blank line after warnings
-}
 
-int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <input_file>\n";
-        return 1;
+    // An object is decoded whole anyway, so only text input streams
+    if (streaming) {
+        if (linker.isObjectInput()) {
+            std::cerr << "Error: --stream links text input: " << argv[optind] << "\n";
+            return 1;
+        }
+        linker.streamFd = STDOUT_FILENO;
+        jobs = 1;
     }
 
-    input_file.open(argv[1]);
-    if (!input_file) {
-        std::cerr << "Error opening file: " << argv[1] << "\n";
-        return 1;
+    // Counters only exist for -T; without it the link takes none of their branches
+    LinkStats stats;
+    if (reportTimings) {
+        linker.stats = &stats;
+        linker.collectDiagnostics = true;
     }
 
     try {
-        pass1();
-        printWarnings();
-        printSymbolTable();
-
-        warnings.clear();
-
-        std::cout << "Memory Map\n";
-        pass2();
-        printWarnings();
+        auto start = std::chrono::steady_clock::now();
+        linker.pass1();
+        linker.resolveArchives();
+        double pass1Ms = elapsedMs(start);
+
+        if (objectPath) {
+            std::string problem;
+            if (!linker.writeObject(objectPath, problem)) {
+                if (!problem.empty()) std::cerr << "Error: " << problem << "\n";
+                std::cerr << "Error writing object file: " << objectPath << "\n";
+                return 1;
+            }
+            return 0;
+        }
+        if (archivePath) {
+            std::string problem;
+            if (!linker.writeArchive(archivePath, problem)) {
+                if (!problem.empty()) std::cerr << "Error: " << problem << "\n";
+                std::cerr << "Error writing archive file: " << archivePath << "\n";
+                return 1;
+            }
+            return 0;
+        }
 
-        // No need for additional std::cout << std::endl; here, as it's already added in pass2() and printWarnings()
+        start = std::chrono::steady_clock::now();
+        if (!gcEntries.empty()) linker.collectModules(gcEntries);
+        linker.listing(jobs);
+        double pass2Ms = elapsedMs(start);
+        if (linker.cacheEnabled && !linker.writeCache(cachePath)) {
+            std::cerr << "Warning: could not write cache file: " << cachePath << "\n";
+        }
+        start = std::chrono::steady_clock::now();
+        size_t outputBytes = linker.out.total();
+        linker.out.flush();
+        double outputMs = elapsedMs(start);
+
+        // No need for additional blank line here, as it's already added in pass2() and printWarnings()
+
+        if (reportTimings) {
+            std::cerr << std::fixed << std::setprecision(3)
+                      << "pass1: " << pass1Ms << " ms (" << linker.moduleCount() << " modules, "
+                      << linker.totalInstructions << " instructions, " << scanner.name << " scanner)\n"
+                      << "pass2: " << pass2Ms << " ms (" << jobs << " jobs)\n"
+                      << "output: " << outputMs << " ms (" << outputBytes << " bytes)\n";
+            linker.countStats();
+            double pass1Sec = std::max(pass1Ms, 1e-6) / 1000;
+            std::cerr << std::setprecision(0)
+                      << "throughput: " << linker.input_size << " bytes, " << stats.tokens << " tokens in pass1; "
+                      << linker.input_size / pass1Sec << " bytes/sec, " << stats.tokens / pass1Sec << " tokens/sec\n"
+                      << std::setprecision(2)
+                      << "symbols: " << stats.symbols.lookups << " lookups, " << stats.symbols.probes << " probes ("
+                      << double(stats.symbols.probes) / std::max<size_t>(stats.symbols.lookups, 1)
+                      << " per lookup)\n"
+                      << "modes:";
+            for (int i = 0; i < 5; i++) std::cerr << " " << "MARIE"[i] << "=" << stats.modes[i];
+            std::cerr << "\ndiagnostics:";
+            size_t diagnosticCount = 0;
+            for (int code = 0; code < Diagnostic::CODES; code++) {
+                if (stats.diagnostics[code] == 0) continue;
+                std::cerr << " " << Diagnostic::name(Diagnostic::Code(code)) << "=" << stats.diagnostics[code];
+                diagnosticCount += stats.diagnostics[code];
+            }
+            std::cerr << (diagnosticCount ? "\n" : " none\n") << std::setprecision(3);
+            if (!gcEntries.empty()) {
+                std::cerr << "gc: dropped " << linker.droppedModules << " of " << linker.modules.size()
+                          << " modules\n";
+            }
+            if (!archives.empty()) {
+                std::cerr << "archives: pulled " << linker.pulledMembers << " members\n";
+            }
+            if (linker.cacheEnabled) {
+                std::cerr << "cache: reused " << linker.reusedRecords << " records and " << linker.reusedRelocations
+                          << " relocations of " << linker.modules.size() << " modules\n";
+            }
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            std::cerr << "memory: " << usage.ru_maxrss << " KB peak RSS\n";
+        }
+    } catch (const ParseError&) {
+        linker.out.flush();
+        return 1;
     } catch (const std::exception& e) {
+        linker.out.flush();
         std::cerr << "An error occurred: " << e.what() << std::endl;
         return 1;
     }
 
-    input_file.close();
     return 0;
-}
\ No newline at end of file
+}
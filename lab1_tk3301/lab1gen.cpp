@@ -0,0 +1,299 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <getopt.h>
+
+// Synthetic linker input at any scale. Every module defines its share of the global symbols
+// s<g> (g in base 36) and uses the symbols that follow its own, so each symbol is used once
+// for every use slot there is; its first instructions reference each uselist entry, the rest
+// follow the instruction mix. Without -e the input links without a single error or warning
+// (given at least as many uses as definitions per module); with -e that fraction of
+// definitions, uselist entries and instructions gets a semantic error instead.
+
+struct Options {
+    uint64_t modules = 1000;
+    uint64_t defs = 4;              // per module
+    uint64_t uses = 4;              // per module
+    uint64_t instructions = 16;     // per module
+    uint64_t mix[5] = {1, 1, 1, 1, 1};  // weights of M, A, R, I, E
+    double errorRate = 0;
+    uint64_t seed = 1;
+    uint64_t targetBytes = 0;       // if set, the module count is derived from it
+    int operandDigits = 0;          // 0: the fewest that hold every operand
+};
+
+// splitmix64: fast, and the same input for the same seed everywhere
+class Random {
+private:
+    uint64_t state;
+
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t below(uint64_t n) { return n ? next() % n : 0; }
+    uint64_t between(uint64_t lo, uint64_t hi) { return lo + below(hi - lo); }   // [lo, hi)
+    bool chance(double p) { return p > 0 && (next() >> 11) * 0x1.0p-53 < p; }
+};
+
+// Buffered output; gigabyte inputs spend their time formatting, not in stdio.
+// Without a file it only counts the bytes.
+class Writer {
+private:
+    FILE* file;
+    std::vector<char> buffer;
+    size_t used = 0;
+    uint64_t written = 0;
+
+public:
+    explicit Writer(FILE* file) : file(file), buffer(1 << 20) {}
+    ~Writer() { flush(); }
+
+    void flush() {
+        if (file) fwrite(buffer.data(), 1, used, file);
+        used = 0;
+    }
+
+    void append(char c) {
+        if (used == buffer.size()) flush();
+        buffer[used++] = c;
+        written++;
+    }
+
+    void append(const char* text) {
+        while (*text) append(*text++);
+    }
+
+    void appendInt(uint64_t value, int base = 10) {
+        char digits[24];
+        int n = 0;
+        do {
+            digits[n++] = "0123456789abcdefghijklmnopqrstuvwxyz"[value % base];
+            value /= base;
+        } while (value != 0);
+        while (n > 0) append(digits[--n]);
+    }
+
+    uint64_t bytes() const { return written; }
+};
+
+class Generator {
+private:
+    const Options& opt;
+    Random random;
+    Writer& out;
+    uint64_t base;                  // 10^operandDigits
+    uint64_t immediateLimit;
+    uint64_t machineSize;           // total instructions
+    uint64_t symbols;
+    uint64_t mixTotal;
+
+    void symbol(char prefix, uint64_t g) {
+        out.append(prefix);
+        out.appendInt(g, 36);
+    }
+
+    void instruction(char mode, uint64_t opcode, uint64_t operand) {
+        out.append(' ');
+        out.append(mode);
+        out.append(' ');
+        out.appendInt(opcode * base + operand);
+    }
+
+    char pickMode() {
+        uint64_t r = random.below(mixTotal);
+        for (int i = 0; i < 5; i++) {
+            if (r < opt.mix[i]) return "MARIE"[i];
+            r -= opt.mix[i];
+        }
+        return 'R';
+    }
+
+public:
+    Generator(const Options& opt, Writer& out, int operandDigits)
+        : opt(opt), random(opt.seed), out(out) {
+        base = 1;
+        for (int i = 0; i < operandDigits; i++) base *= 10;
+        immediateLimit = base - base / 10;
+        machineSize = opt.modules * opt.instructions;
+        symbols = opt.modules * opt.defs;
+        mixTotal = 0;
+        for (uint64_t w : opt.mix) mixTotal += w;
+    }
+
+    void module(uint64_t m) {
+        uint64_t count = opt.instructions;
+
+        out.appendInt(opt.defs);
+        for (uint64_t d = 0; d < opt.defs; d++) {
+            out.append(' ');
+            symbol('s', m * opt.defs + d);
+            out.append(' ');
+            out.appendInt(random.chance(opt.errorRate) ? random.between(count, count + 100) : d % count);
+        }
+        out.append('\n');
+
+        out.appendInt(opt.uses);
+        for (uint64_t u = 0; u < opt.uses; u++) {
+            out.append(' ');
+            uint64_t g = (m * opt.uses + u + opt.defs) % symbols;
+            symbol(random.chance(opt.errorRate) ? 'u' : 's', g);   // nothing defines u<g>
+        }
+        out.append('\n');
+
+        out.appendInt(count);
+        for (uint64_t i = 0; i < count; i++) {
+            if (i > 0 && i % 16 == 0) out.append('\n');
+            uint64_t opcode = random.below(10);
+            bool error = random.chance(opt.errorRate);
+            if (i < opt.uses) {
+                instruction('E', opcode, error ? random.between(opt.uses, base) : i);
+                continue;
+            }
+
+            char mode = pickMode();
+            if (mode == 'E' && opt.uses == 0) mode = 'R';
+            if (error && random.below(6) == 0) {
+                instruction(mode, random.between(10, 20), random.below(base));
+                continue;
+            }
+            switch (mode) {
+                case 'M':
+                    instruction(mode, opcode, error ? random.between(opt.modules, base) : random.below(opt.modules));
+                    break;
+                case 'A':
+                    instruction(mode, opcode, error ? random.between(machineSize, base) : random.below(machineSize));
+                    break;
+                case 'R':
+                    instruction(mode, opcode, error ? random.between(count, base) : random.below(count));
+                    break;
+                case 'I':
+                    instruction(mode, opcode, error ? random.between(immediateLimit, base) : random.below(immediateLimit));
+                    break;
+                case 'E':
+                    instruction(mode, opcode, error ? random.between(opt.uses, base) : random.below(opt.uses));
+                    break;
+            }
+        }
+        out.append('\n');
+    }
+};
+
+// 100, 64K, 10M, 1G: a byte count with an optional binary suffix
+bool parseSize(const char* text, uint64_t& size) {
+    char* end;
+    size = strtoull(text, &end, 10);
+    if (end == text) return false;
+    switch (*end) {
+        case 'K': case 'k': size <<= 10; end++; break;
+        case 'M': case 'm': size <<= 20; end++; break;
+        case 'G': case 'g': size <<= 30; end++; break;
+    }
+    return *end == '\0';
+}
+
+bool parseMix(const char* text, uint64_t mix[5]) {
+    for (int i = 0; i < 5; i++) {
+        char* end;
+        mix[i] = strtoull(text, &end, 10);
+        if (end == text || *end != (i < 4 ? ',' : '\0')) return false;
+        text = end + 1;
+    }
+    return mix[0] + mix[1] + mix[2] + mix[3] + mix[4] > 0;
+}
+
+int digitsFor(uint64_t value) {
+    int digits = 1;
+    for (uint64_t limit = 10; limit <= value; limit *= 10) digits++;
+    return digits;
+}
+
+void show_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options] > input\n";
+    std::cerr << "  -m modules: modules to generate (default 1000)\n";
+    std::cerr << "  -S size: generate about this many bytes instead, e.g. 64M or 1G\n";
+    std::cerr << "  -d defs: symbols defined per module (default 4)\n";
+    std::cerr << "  -u uses: uselist entries per module (default 4)\n";
+    std::cerr << "  -i instructions: instructions per module (default 16)\n";
+    std::cerr << "  -x M,A,R,I,E: instruction mix weights (default 1,1,1,1,1)\n";
+    std::cerr << "  -e rate: fraction of definitions, uses and instructions given an error (default 0)\n";
+    std::cerr << "  -s seed: random seed (default 1)\n";
+    std::cerr << "  --operand-digits d: operand field width (default: the fewest that fit)\n";
+    std::cerr << "The linker options the input needs are printed to stderr.\n";
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    static const struct option longOptions[] = {
+        {"operand-digits", required_argument, nullptr, 256},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "m:S:d:u:i:x:e:s:", longOptions, nullptr)) != -1) {
+        bool ok = true;
+        switch (c) {
+            case 'm': opt.modules = strtoull(optarg, nullptr, 10); ok = opt.modules > 0; break;
+            case 'S': ok = parseSize(optarg, opt.targetBytes) && opt.targetBytes > 0; break;
+            case 'd': opt.defs = strtoull(optarg, nullptr, 10); break;
+            case 'u': opt.uses = strtoull(optarg, nullptr, 10); break;
+            case 'i': opt.instructions = strtoull(optarg, nullptr, 10); ok = opt.instructions > 0; break;
+            case 'x': ok = parseMix(optarg, opt.mix); break;
+            case 'e': opt.errorRate = atof(optarg); ok = opt.errorRate >= 0 && opt.errorRate <= 1; break;
+            case 's': opt.seed = strtoull(optarg, nullptr, 10); break;
+            case 256: opt.operandDigits = atoi(optarg); ok = opt.operandDigits >= 3 && opt.operandDigits <= 17; break;
+            default: ok = false; break;
+        }
+        if (!ok) {
+            show_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc) {
+        show_usage(argv[0]);
+        return 1;
+    }
+
+    // Every uselist entry is referenced by its own E instruction, and there has to be a symbol to use
+    opt.uses = std::min(opt.uses, opt.instructions);
+    if (opt.defs == 0) opt.uses = 0;
+
+    if (opt.targetBytes) {
+        // Size one module, then scale; modules differ only in their numbers
+        Writer sample(nullptr);
+        Options probe = opt;
+        probe.modules = 1000000;
+        Generator(probe, sample, 7).module(probe.modules / 2);
+        opt.modules = std::max<uint64_t>(1, opt.targetBytes / sample.bytes());
+    }
+
+    uint64_t machineSize = opt.modules * opt.instructions;
+    int digits = opt.operandDigits;
+    if (digits == 0) digits = std::max(3, digitsFor(std::max(machineSize, opt.modules)));
+    if (digits > 17 || digitsFor(std::max(machineSize, opt.modules)) > digits) {
+        std::cerr << "Error: " << machineSize << " instructions do not fit " << digits << " operand digits\n";
+        return 1;
+    }
+
+    Writer out(stdout);
+    Generator generator(opt, out, digits);
+    for (uint64_t m = 0; m < opt.modules; m++) generator.module(m);
+    out.flush();
+
+    std::cerr << "lab1gen: " << opt.modules << " modules, " << machineSize << " instructions, "
+              << out.bytes() << " bytes\n"
+              << "link with: --machine-size " << machineSize << " --max-modules " << opt.modules
+              << " --max-defs " << opt.defs << " --max-uses " << opt.uses << " --operand-digits " << digits << "\n";
+    return 0;
+}
@@ -0,0 +1,1537 @@
+#include "linker.h"
+
+#include <stdexcept>
+#include <charconv>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+bool setupMachine(MachineProfile& machine) {
+    if (machine.machineSize <= 0 || machine.maxModules <= 0 || machine.maxDefs < 0 || machine.maxUses < 0 ||
+        machine.operandDigits < 3 || machine.operandDigits > 17) {
+        return false;
+    }
+
+    machine.operandBase = 1;
+    for (int i = 0; i < machine.operandDigits; i++) machine.operandBase *= 10;
+    machine.immediateLimit = machine.operandBase - machine.operandBase / 10;
+    machine.wordWidth = machine.operandDigits + 1;
+
+    // Words wider than the classic layout are 64-bit; the classic one keeps std::stoi's int range
+    if (machine.operandDigits > 3) {
+        machine.maxWord = INT64_MAX;
+        machine.minWord = INT64_MIN;
+    } else {
+        machine.maxWord = INT_MAX;
+        machine.minWord = INT_MIN;
+    }
+
+    machine.addressWidth = 3;
+    for (int64_t limit = 1000; limit < machine.machineSize; limit *= 10) machine.addressWidth++;
+
+    int64_t illegalWord = 10 * machine.operandBase - 1;
+    machine.illegalOpcodeError = " Error: Illegal opcode; treated as " + std::to_string(illegalWord);
+    machine.illegalImmediateError = " Error: Illegal immediate operand; treated as " +
+                                    std::to_string(machine.operandBase - 1);
+    return true;
+}
+
+bool mapFile(const char* path, const char*& data, size_t& size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    size = st.st_size;
+    data = nullptr;
+    if (size > 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapped);
+    }
+    close(fd);
+    return true;
+}
+
+#ifdef __SSE2__
+// Byte lanes of v that are ' ' or '\t'..'\r', matching isSpace()
+inline __m128i spaceLanes(__m128i v) {
+    __m128i control = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    control = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8('\r' - '\t')), control);
+    return _mm_or_si128(control, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+// Byte lanes of v that are ASCII letters or digits, matching isAlnum() in the C locale
+inline __m128i alnumLanes(__m128i v) {
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8('z' - 'a')), letter);
+    __m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    return _mm_or_si128(letter, digit);
+}
+
+// The last partial block of the input is classified from a copy padded with spaces
+inline const char* fullBlock(const char* p, size_t readable, char* copy) {
+    if (readable >= 64) return p;
+    memset(copy, ' ', 64);
+    memcpy(copy, p, readable);
+    return copy;
+}
+
+void classifySSE2(const char* p, size_t readable, uint64_t& spaces, uint64_t& alnums) {
+    char copy[64];
+    p = fullBlock(p, readable, copy);
+    spaces = 0;
+    alnums = 0;
+    for (int i = 0; i < 64; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        spaces |= uint64_t(uint32_t(_mm_movemask_epi8(spaceLanes(v)))) << i;
+        alnums |= uint64_t(uint32_t(_mm_movemask_epi8(alnumLanes(v)))) << i;
+    }
+}
+
+__attribute__((target("avx2"))) void classifyAVX2(const char* p, size_t readable, uint64_t& spaces,
+                                                  uint64_t& alnums) {
+    char copy[64];
+    p = fullBlock(p, readable, copy);
+    spaces = 0;
+    alnums = 0;
+    for (int i = 0; i < 64; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i control = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+        control = _mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8('\r' - '\t')), control);
+        __m256i space = _mm256_or_si256(control, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+
+        __m256i letter = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+        letter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8('z' - 'a')), letter);
+        __m256i digit = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+        digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+
+        spaces |= uint64_t(uint32_t(_mm256_movemask_epi8(space))) << i;
+        alnums |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_or_si256(letter, digit)))) << i;
+    }
+}
+#endif
+
+const Scanner scanners[] = {
+    {"scalar", nullptr},
+#ifdef __SSE2__
+    {"sse2", classifySSE2},
+    {"avx2", classifyAVX2},
+#endif
+};
+
+// Runs during static initialization too, so it sets up the CPU feature checks itself
+Scanner widestScanner() {
+#ifdef __SSE2__
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2")) return scanners[1];
+#endif
+    return scanners[sizeof(scanners) / sizeof(scanners[0]) - 1];
+}
+
+Scanner scanner = widestScanner();
+
+bool selectScanner(const char* name) {
+    if (strcmp(name, "auto") == 0) {
+        scanner = widestScanner();
+        return true;
+    }
+    for (const Scanner& s : scanners) {
+        if (strcmp(name, s.name) != 0) continue;
+#ifdef __SSE2__
+        if (s.classify == classifyAVX2 && !__builtin_cpu_supports("avx2")) return false;
+#endif
+        scanner = s;
+        return true;
+    }
+    return false;
+}
+
+bool openObject(const char* data, size_t size, ObjectImage& image) {
+    ObjectHeader& header = image.header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, OBJECT_MAGIC, sizeof(OBJECT_MAGIC)) != 0 ||
+        header.defCount > size || header.useCount > size || header.instructionCount > size) {
+        return false;
+    }
+
+    size_t moduleBytes = sizeof(ObjectModule) * size_t(header.moduleCount);
+    size_t expected = sizeof(ObjectHeader) + moduleBytes + sizeof(ObjectDef) * header.defCount +
+                      sizeof(SymbolName) * header.useCount + sizeof(uint64_t) * header.instructionCount;
+    if (header.version != OBJECT_VERSION || expected != size) return false;
+
+    image.moduleRecords = reinterpret_cast<const ObjectModule*>(data + sizeof(ObjectHeader));
+    image.defs = reinterpret_cast<const ObjectDef*>(data + sizeof(ObjectHeader) + moduleBytes);
+    image.uses = reinterpret_cast<const SymbolName*>(image.defs + header.defCount);
+    image.instructions = reinterpret_cast<const uint64_t*>(image.uses + header.useCount);
+    return true;
+}
+
+std::vector<Archive> archives;
+
+// Maps an archive and checks its layout; only the module records are walked, not the members
+bool openArchive(const char* path, Archive& archive) {
+    const char* data;
+    size_t size;
+    if (!mapFile(path, data, size)) return false;
+
+    ArchiveHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    size_t indexBytes = sizeof(ArchiveEntry) * size_t(header.indexCount);
+    if (memcmp(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 || header.version != ARCHIVE_VERSION ||
+        indexBytes > size - sizeof(header)) {
+        return false;
+    }
+
+    archive.index = reinterpret_cast<const ArchiveEntry*>(data + sizeof(header));
+    archive.indexCount = header.indexCount;
+    size_t objectOffset = sizeof(header) + indexBytes;
+    if (!openObject(data + objectOffset, size - objectOffset, archive.object)) return false;
+
+    const ObjectHeader& object = archive.object.header;
+    size_t defs = 0, uses = 0, instructions = 0;
+    for (uint32_t m = 0; m < object.moduleCount; m++) {
+        const ObjectModule& record = archive.object.moduleRecords[m];
+        archive.defStart.push_back(defs);
+        archive.useStart.push_back(uses);
+        archive.instructionStart.push_back(instructions);
+        defs += record.defCount;
+        uses += record.useCount;
+        instructions += record.storedInstructions;
+        if (!record.complete || defs > object.defCount || uses > object.useCount ||
+            instructions > object.instructionCount) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < archive.indexCount; i++) {
+        if (archive.index[i].module >= object.moduleCount) return false;
+    }
+    return true;
+}
+
+// FNV-1a style, eight bytes per step
+uint64_t hashBytes(const char* data, size_t size, uint64_t h) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0x100000001b3ull;
+        h ^= h >> 32;
+    }
+    for (; i < size; i++) {
+        h = (h ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+uint64_t hashValue(uint64_t h, int64_t value) {
+    return hashBytes(reinterpret_cast<const char*>(&value), sizeof(value), h);
+}
+
+bool cacheMatchesProfile(const CacheHeader& header, const MachineProfile& machine) {
+    return header.machineSize == machine.machineSize && header.maxModules == machine.maxModules &&
+           header.maxDefs == machine.maxDefs && header.maxUses == machine.maxUses &&
+           header.operandDigits == machine.operandDigits;
+}
+
+Linker::~Linker() {
+    if (inputMapped && input_data) munmap(const_cast<char*>(input_data), input_size);
+    if (cacheData) munmap(const_cast<char*>(cacheData), cacheSize);
+}
+
+// Puts the error message after the output formatted so far and abandons the link
+void Linker::__parseerror(int errcode) {
+    static const char* errstr[] = {
+        "NUM_EXPECTED",        // 0
+        "SYM_EXPECTED",        // 1
+        "ADDR_EXPECTED",       // 2
+        "SYM_TOO_LONG",        // 3
+        "TOO_MANY_DEF_IN_MODULE", // 4
+        "TOO_MANY_USE_IN_MODULE", // 5
+        "TOO_MANY_INSTR",      // 6
+        "MARIE_EXPECTED"       // 7
+    };
+    out.append("Parse Error line ");
+    out.appendInt(linenum);
+    out.append(" offset ");
+    out.appendInt(lineoffset);
+    out.append(": ");
+    out.append(errstr[errcode]);
+    out.append('\n');
+    if (collectDiagnostics) {
+        diagnostics.push_back({Diagnostic::PARSE_ERROR, true, -1, -1, linenum, lineoffset, "",
+                               "Parse Error line " + std::to_string(linenum) + " offset " +
+                               std::to_string(lineoffset) + ": " + errstr[errcode]});
+    }
+    throw ParseError();
+}
+
+void Linker::classifyAt(size_t pos) {
+    maskBase = pos;
+    scanner.classify(input_data + pos, input_size - pos, spaceBits, alnumBits);
+}
+
+// First position in [pos, limit) that is (space ? whitespace : not whitespace), or limit
+inline size_t Linker::scanTo(size_t pos, size_t limit, bool space) {
+    if (!scanner.classify) {
+        while (pos < limit && isSpace(input_data[pos]) != space) pos++;
+        return pos;
+    }
+    while (pos < limit) {
+        if (pos < maskBase || pos - maskBase >= 64) classifyAt(pos);
+        uint64_t bits = (space ? spaceBits : ~spaceBits) >> (pos - maskBase);
+        if (bits) return std::min(limit, pos + __builtin_ctzll(bits));
+        pos = maskBase + 64;
+    }
+    return limit;
+}
+
+// Returns false at end of input, leaving linenum/lineoffset on the last line
+bool Linker::getToken(std::string_view& token) {
+    // Most tokens start and end inside the classified window, before the line's newline
+    size_t pos = line_start + current_pos;
+    if (current_pos < line_length && pos >= maskBase && pos - maskBase < 64) {
+        uint64_t others = ~spaceBits >> (pos - maskBase);
+        if (others) {
+            size_t start = pos + __builtin_ctzll(others);
+            uint64_t spaces = spaceBits >> (start - maskBase);
+            size_t newline = line_start + line_length - 1;
+            if (start < newline && spaces) {
+                size_t end = std::min(newline, start + __builtin_ctzll(spaces));
+                lineoffset += start - pos;
+                current_pos = end - line_start;
+                token = std::string_view(input_data + start, end - start);
+                return true;
+            }
+        }
+    }
+
+    while (true) {
+        // If we're at the end of the current line or haven't read a line yet
+        if (current_pos >= line_length) {
+            if (next_line_start >= input_size) {
+                return false;
+            }
+            line_start = next_line_start;
+            const void* nl = memchr(input_data + line_start, '\n', input_size - line_start);
+            size_t line_end = nl ? static_cast<const char*>(nl) - input_data : input_size;
+            line_length = line_end - line_start + 1;  // always count the newline
+            next_line_start = line_end + 1;
+            linenum++;
+            current_pos = 0;
+            lineoffset = 1; // Reset offset to start of the new line
+        }
+
+        size_t newline = line_length - 1;
+        size_t pos = scanTo(line_start + current_pos, line_start + newline, false) - line_start;
+        lineoffset += pos - current_pos;
+        current_pos = pos;
+
+        // Skipping the newline itself leaves lineoffset just past the end of the line
+        if (current_pos == newline) {
+            lineoffset = line_length;
+            current_pos = line_length;
+            continue;
+        }
+
+        size_t token_start_pos = current_pos;
+        current_pos = scanTo(line_start + current_pos, line_start + newline, true) - line_start;
+
+        token = std::string_view(input_data + line_start + token_start_pos, current_pos - token_start_pos);
+        return true;
+    }
+}
+
+// Same acceptance as std::stoi over the whole token: optional sign, decimal digits, int range
+bool Linker::readInt(int& value) {
+    std::string_view token;
+    if (!getToken(token)) return false;
+
+    const char* first = token.data();
+    const char* last = first + token.size();
+    if (*first == '+' && last - first > 1 && first[1] != '-') first++;
+
+    auto result = std::from_chars(first, last, value);
+    if (result.ec != std::errc() || result.ptr != last) __parseerror(0);
+    return true;
+}
+
+// Instruction words may be wider than an int, depending on the machine profile
+bool Linker::readWord(int64_t& value) {
+    std::string_view token;
+    if (!getToken(token)) return false;
+
+    const char* first = token.data();
+    const char* last = first + token.size();
+    if (*first == '+' && last - first > 1 && first[1] != '-') first++;
+
+    auto result = std::from_chars(first, last, value);
+    if (result.ec != std::errc() || result.ptr != last) __parseerror(0);
+    if (value > machine.maxWord || value < machine.minWord) __parseerror(0);
+    return true;
+}
+
+std::string_view Linker::readSymbol() {
+    std::string_view token;
+    if (!getToken(token) || !isAlpha(token[0])) __parseerror(1);
+    if (token.length() > 16) __parseerror(3);
+    if (!scanner.classify) {
+        for (char c : token) {
+            if (!isAlnum(c)) __parseerror(1);
+        }
+    } else {
+        size_t start = token.data() - input_data;
+        if (start < maskBase || start + token.length() > maskBase + 64) classifyAt(start);
+        uint64_t want = (uint64_t(1) << token.length()) - 1;
+        if ((alnumBits >> (start - maskBase) & want) != want) __parseerror(1);
+    }
+    lineoffset = current_pos + 1;
+    return token;
+}
+
+char Linker::readMARIE() {
+    std::string_view token;
+    if (!getToken(token) || token.length() != 1 || modeIndex(token[0]) < 0) {
+        __parseerror(7); // MARIE_EXPECTED
+    }
+    lineoffset = current_pos + 1;
+    return token[0];
+}
+
+// Tokenizes the next module. Returns false if the input ends before its def count;
+// a module cut short later on is returned with complete == false.
+bool Linker::parseModule(Module& module) {
+    int defCount;
+    if (!readInt(defCount)) return false;
+    if (defCount > machine.maxDefs) __parseerror(4);
+
+    module.line = linenum;
+    module.offset = lineoffset;
+    module.baseAddress = totalInstructions;
+    module.instructionCount = 0;
+    module.complete = false;
+
+    for (int i = 0; i < defCount; i++) {
+        std::string_view symbol = readSymbol();
+        int value;
+        if (!readInt(value)) return true;
+        module.defList.push_back({symbol, value});
+    }
+
+    int useCount;
+    if (!readInt(useCount)) return true;
+    if (useCount > machine.maxUses) __parseerror(5);
+    if (useCount > 0) module.useList.reserve(useCount);
+    for (int i = 0; i < useCount; i++) module.useList.push_back(readSymbol());
+
+    int instructionCount;
+    if (!readInt(instructionCount)) return true;
+    if (static_cast<int64_t>(totalInstructions) + instructionCount > machine.machineSize) __parseerror(6);
+
+    if (instructionCount > 0) module.instructions.reserve(instructionCount);
+    for (int i = 0; i < instructionCount; i++) {
+        char addressMode = readMARIE();
+        int64_t instruction;
+        if (!readWord(instruction)) return true;
+        module.instructions.push_back({addressMode, instruction});
+    }
+    module.instructionCount = instructionCount;
+    module.complete = true;
+    return true;
+}
+
+// Enters a parsed module's definitions into the symbol table and assigns its base address
+void Linker::defineModule(Module& module, int moduleCount) {
+    for (const Definition& def : module.defList) {
+        SymbolName name(def.name);
+        Symbol* existing = symbolTable.find(name, probeStats());
+        if (existing) {
+            if (!existing->multiplyDefined) {
+                existing->multiplyDefined = true;
+                warnings.push_back("Warning: Module " + std::to_string(moduleCount) + ": " + std::string(def.name) + " redefinition ignored");
+                if (collectDiagnostics) {
+                    diagnostics.push_back({Diagnostic::REDEFINED_SYMBOL, false, moduleCount, -1, -1, -1,
+                                           std::string(def.name), warnings.back()});
+                }
+            }
+            continue;
+        }
+
+        module.definedSymbols.push_back(symbolTable.size());
+        symbolTable.insert({name, def.value + totalInstructions, true, false, false, moduleCount});
+    }
+
+    // Definitions read before the input ended stay defined, but the module gets no base
+    if (!module.complete) return;
+
+    // Only this module's own definitions can be out of range; check them in name order
+    int instructionCount = module.instructionCount;
+    std::vector<int>& defined = module.definedSymbols;
+    std::sort(defined.begin(), defined.end(),
+              [this](int a, int b) { return symbolTable[a].name < symbolTable[b].name; });
+    for (int index : defined) {
+        Symbol* sym = &symbolTable[index];
+        if (sym->value - totalInstructions >= instructionCount) {
+            warnings.push_back("Warning: Module " + std::to_string(moduleCount) + ": " + std::string(sym->name.view()) + 
+                               "=" + std::to_string(sym->value - totalInstructions) + 
+                               " valid=[0.." + std::to_string(instructionCount-1) + "] assume zero relative");
+            if (collectDiagnostics) {
+                diagnostics.push_back({Diagnostic::DEFINITION_TOO_LARGE, false, moduleCount, -1, -1, -1,
+                                       std::string(sym->name.view()), warnings.back()});
+            }
+            sym->value = totalInstructions;
+        }
+    }
+
+    moduleBaseAddresses.push_back(totalInstructions);
+    totalInstructions += instructionCount;
+}
+
+bool Linker::isObjectInput() {
+    return input_size >= sizeof(OBJECT_MAGIC) && memcmp(input_data, OBJECT_MAGIC, sizeof(OBJECT_MAGIC)) == 0;
+}
+
+bool Linker::writeObjectImage(FILE* file, std::string& problem) {
+    ObjectHeader header = {};
+    memcpy(header.magic, OBJECT_MAGIC, sizeof(OBJECT_MAGIC));
+    header.version = OBJECT_VERSION;
+    header.moduleCount = modules.size();
+    for (const Module& module : modules) {
+        header.defCount += module.defList.size();
+        header.useCount += module.useList.size();
+        header.instructionCount += module.instructions.size();
+        for (const Instruction& instr : module.instructions) {
+            if (instr.word >= PACKED_WORD_LIMIT || instr.word < -PACKED_WORD_LIMIT) {
+                problem = "instruction word " + std::to_string(instr.word) + " does not fit the object format";
+                return false;
+            }
+        }
+    }
+
+    std::vector<ObjectModule> moduleRecords;
+    std::vector<ObjectDef> defs;
+    std::vector<SymbolName> uses;
+    std::vector<uint64_t> instructions;
+    moduleRecords.reserve(modules.size());
+    defs.reserve(header.defCount);
+    uses.reserve(header.useCount);
+    instructions.reserve(header.instructionCount);
+
+    for (const Module& module : modules) {
+        moduleRecords.push_back({module.line, module.offset,
+                                 static_cast<uint32_t>(module.defList.size()),
+                                 static_cast<uint32_t>(module.useList.size()),
+                                 static_cast<uint32_t>(module.instructions.size()),
+                                 module.instructionCount, module.complete, 0});
+        for (const Definition& def : module.defList) defs.push_back({SymbolName(def.name), def.value});
+        for (std::string_view use : module.useList) uses.push_back(SymbolName(use));
+        for (const Instruction& instr : module.instructions) instructions.push_back(packInstruction(instr));
+    }
+
+    return fwrite(&header, sizeof(header), 1, file) == 1 &&
+           fwrite(moduleRecords.data(), sizeof(ObjectModule), moduleRecords.size(), file) == moduleRecords.size() &&
+           fwrite(defs.data(), sizeof(ObjectDef), defs.size(), file) == defs.size() &&
+           fwrite(uses.data(), sizeof(SymbolName), uses.size(), file) == uses.size() &&
+           fwrite(instructions.data(), sizeof(uint64_t), instructions.size(), file) == instructions.size();
+}
+
+bool Linker::writeObject(const char* path, std::string& problem) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    bool ok = writeObjectImage(file, problem);
+    return fclose(file) == 0 && ok;
+}
+
+bool isSymbolName(const SymbolName& name) {
+    std::string_view view = name.view();
+    if (view.empty() || !isAlpha(view[0])) return false;
+    for (char c : view) {
+        if (!isAlnum(c)) return false;
+    }
+    return true;
+}
+
+// Rebuilds one module from its object record; names stay views into the mapping.
+// The record must hold what the parser could have produced, or the object is rejected as
+// malformed; the machine limits are checked again like the parser does, since the object may
+// have been written for another profile.
+Module Linker::objectModule(const ObjectModule& record, const ObjectDef* defs, const SymbolName* uses,
+                    const uint64_t* instructions) {
+    // A module cut short by end of input has no declared count; a complete one stored all of it
+    if (record.complete > 1 || record.instructionCount < 0 ||
+        (record.complete ? record.storedInstructions != uint32_t(record.instructionCount)
+                         : record.instructionCount != 0)) {
+        throw std::runtime_error("malformed object file");
+    }
+    for (uint32_t i = 0; i < record.defCount; i++) {
+        if (!isSymbolName(defs[i].name) || defs[i].value < INT_MIN || defs[i].value > INT_MAX) {
+            throw std::runtime_error("malformed object file");
+        }
+    }
+    for (uint32_t i = 0; i < record.useCount; i++) {
+        if (!isSymbolName(uses[i])) throw std::runtime_error("malformed object file");
+    }
+    for (uint32_t i = 0; i < record.storedInstructions; i++) {
+        if (modeIndex(unpackInstruction(instructions[i]).mode) < 0) throw std::runtime_error("malformed object file");
+    }
+
+    // Limit errors are reported at the module's position in the original source
+    linenum = record.line;
+    lineoffset = record.offset;
+    if (int64_t(record.defCount) > machine.maxDefs) __parseerror(4);
+    if (int64_t(record.useCount) > machine.maxUses) __parseerror(5);
+    if (static_cast<int64_t>(totalInstructions) + record.storedInstructions > machine.machineSize) __parseerror(6);
+
+    Module module;
+    module.line = record.line;
+    module.offset = record.offset;
+    module.baseAddress = totalInstructions;
+    module.instructionCount = record.complete ? record.instructionCount : 0;
+    module.complete = record.complete;
+
+    module.defList.reserve(record.defCount);
+    for (uint32_t i = 0; i < record.defCount; i++) {
+        module.defList.push_back({defs[i].name.view(), static_cast<int>(defs[i].value)});
+    }
+    module.useList.reserve(record.useCount);
+    for (uint32_t i = 0; i < record.useCount; i++) {
+        module.useList.push_back(uses[i].view());
+    }
+    module.instructions.reserve(record.storedInstructions);
+    for (uint32_t i = 0; i < record.storedInstructions; i++) {
+        module.instructions.push_back(unpackInstruction(instructions[i]));
+    }
+    return module;
+}
+
+void Linker::loadObject() {
+    ObjectImage image;
+    if (!openObject(input_data, input_size, image)) throw std::runtime_error("malformed object file");
+
+    const ObjectDef* defs = image.defs;
+    const SymbolName* uses = image.uses;
+    const uint64_t* instructions = image.instructions;
+    const ObjectDef* defsEnd = defs + image.header.defCount;
+    const SymbolName* usesEnd = uses + image.header.useCount;
+    const uint64_t* instructionsEnd = instructions + image.header.instructionCount;
+
+    for (uint32_t m = 0; m < image.header.moduleCount; m++) {
+        const ObjectModule& record = image.moduleRecords[m];
+        if (record.defCount > size_t(defsEnd - defs) || record.useCount > size_t(usesEnd - uses) ||
+            record.storedInstructions > size_t(instructionsEnd - instructions)) {
+            throw std::runtime_error("malformed object file");
+        }
+
+        modules.push_back(objectModule(record, defs, uses, instructions));
+        defs += record.defCount;
+        uses += record.useCount;
+        instructions += record.storedInstructions;
+
+        defineModule(modules.back(), modules.size() - 1);
+        if (!modules.back().complete) return;
+        if (modules.size() > size_t(machine.maxModules)) __parseerror(6);
+    }
+}
+
+bool Linker::isArchiveInput() {
+    return input_size >= sizeof(ARCHIVE_MAGIC) && memcmp(input_data, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) == 0;
+}
+
+bool Linker::writeArchive(const char* path, std::string& problem) {
+    // A member cut short by end of input has no base address to give it
+    if (!modules.empty() && !modules.back().complete) {
+        problem = "input ends inside a module; cannot archive it";
+        return false;
+    }
+
+    std::vector<ArchiveEntry> entries;
+    for (size_t m = 0; m < modules.size(); m++) {
+        for (const Definition& def : modules[m].defList) {
+            entries.push_back({SymbolName(def.name), static_cast<uint32_t>(m), 0});
+        }
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const ArchiveEntry& a, const ArchiveEntry& b) { return a.name < b.name; });
+    entries.erase(std::unique(entries.begin(), entries.end(),
+                              [](const ArchiveEntry& a, const ArchiveEntry& b) { return a.name == b.name; }),
+                  entries.end());
+
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+
+    ArchiveHeader header = {};
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    header.version = ARCHIVE_VERSION;
+    header.indexCount = entries.size();
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(entries.data(), sizeof(ArchiveEntry), entries.size(), file) == entries.size() &&
+              writeObjectImage(file, problem);
+    return fclose(file) == 0 && ok;
+}
+
+// Pulls archive members that define symbols some linked module uses but nothing defines yet.
+// Members are appended in pull order, so their bases follow the input's modules; their own
+// uselists are scanned in turn. The archives are searched in command-line order.
+void Linker::resolveArchives() {
+    // After a truncated input the module numbers and base addresses no longer line up
+    if (archives.empty() || modules.empty() || !modules.back().complete) return;
+
+    archivePulled.resize(archives.size());
+    for (size_t a = 0; a < archives.size(); a++) {
+        archivePulled[a].assign(archives[a].object.header.moduleCount, false);
+    }
+
+    for (size_t m = 0; m < modules.size(); m++) {
+        for (size_t u = 0; u < modules[m].useList.size(); u++) {
+            SymbolName name(modules[m].useList[u]);
+            if (symbolTable.find(name, probeStats())) continue;
+
+            for (size_t a = 0; a < archives.size(); a++) {
+                const Archive& archive = archives[a];
+                int member = archive.lookup(name);
+                if (member < 0) continue;
+                if (!archivePulled[a][member]) {
+                    archivePulled[a][member] = true;
+                    pulledMembers++;
+                    const ObjectImage& object = archive.object;
+                    modules.push_back(objectModule(object.moduleRecords[member],
+                                                   object.defs + archive.defStart[member],
+                                                   object.uses + archive.useStart[member],
+                                                   object.instructions + archive.instructionStart[member]));
+                    defineModule(modules.back(), modules.size() - 1);
+                    if (modules.size() > size_t(machine.maxModules)) __parseerror(6);
+                }
+                break;
+            }
+        }
+    }
+}
+
+// A missing, stale or damaged cache is not an error; the link just starts from scratch
+void Linker::loadCache(const char* path) {
+    if (!mapFile(path, cacheData, cacheSize)) return;
+    const char* data = cacheData;
+    size_t size = cacheSize;
+    if (size < sizeof(CacheHeader)) return;
+
+    const CacheHeader* header = reinterpret_cast<const CacheHeader*>(data);
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header->version != CACHE_VERSION ||
+        !cacheMatchesProfile(*header, machine)) {
+        return;
+    }
+
+    std::vector<CachedModule> loaded;
+    size_t pos = sizeof(CacheHeader);
+    for (uint32_t m = 0; m < header->moduleCount; m++) {
+        if (size - pos < sizeof(CacheModule)) return;
+        const CacheModule* record = reinterpret_cast<const CacheModule*>(data + pos);
+        pos += sizeof(CacheModule);
+
+        size_t need = padded(sizeof(ObjectDef) * size_t(record->defCount)) +
+                      padded(sizeof(SymbolName) * size_t(record->useCount)) +
+                      padded(2 * sizeof(uint64_t) * size_t(record->storedInstructions)) +
+                      padded(sizeof(uint32_t) * size_t(record->usedCount)) + padded(record->outputLength);
+        if (record->outputLength > size || need > size - pos) return;
+
+        CachedModule cached;
+        cached.header = record;
+        cached.defs = reinterpret_cast<const ObjectDef*>(data + pos);
+        pos += padded(sizeof(ObjectDef) * size_t(record->defCount));
+        cached.uses = reinterpret_cast<const SymbolName*>(data + pos);
+        pos += padded(sizeof(SymbolName) * size_t(record->useCount));
+        cached.instructions = reinterpret_cast<const uint64_t*>(data + pos);
+        pos += sizeof(uint64_t) * size_t(record->storedInstructions);
+        cached.words = reinterpret_cast<const int64_t*>(data + pos);
+        pos += sizeof(int64_t) * size_t(record->storedInstructions);
+        cached.used = reinterpret_cast<const uint32_t*>(data + pos);
+        pos += padded(sizeof(uint32_t) * size_t(record->usedCount));
+        cached.output = std::string_view(data + pos, record->outputLength);
+        pos += padded(record->outputLength);
+        loaded.push_back(cached);
+    }
+    cachedModules.swap(loaded);
+}
+
+// The cached bytes must reappear at pos, end on a token boundary, and have been parsed from the
+// same kind of start state: mid-line, unless both are at the very start of the input. A module
+// that did not reach a new line of its own ends with a lineoffset that depends on what preceded
+// it, so it is always reparsed.
+bool Linker::cacheMatches(const CachedModule& cached, size_t pos) {
+    const CacheModule& h = *cached.header;
+    if (h.endLinenum <= h.startLinenum || (linenum == 0) != (h.startLinenum == 0)) return false;
+    if (h.length > input_size - pos) return false;
+    size_t end = pos + h.length;
+    if (end < input_size && !isSpace(input_data[end])) return false;
+    return hashBytes(input_data + pos, h.length) == h.hash;
+}
+
+// Puts the tokenizer just after the token that ends at pos, with the given line state
+void Linker::seekTokenizer(size_t pos, int line, int offset) {
+    const void* nl = pos > 0 ? memrchr(input_data, '\n', pos) : nullptr;
+    line_start = nl ? static_cast<const char*>(nl) - input_data + 1 : 0;
+    const void* eol = memchr(input_data + pos, '\n', input_size - pos);
+    size_t line_end = eol ? static_cast<const char*>(eol) - input_data : input_size;
+    line_length = line_end - line_start + 1;
+    next_line_start = line_end + 1;
+    current_pos = pos - line_start;
+    linenum = line;
+    lineoffset = offset;
+}
+
+// The tokenizer is where the module's bytes start, as parseModule() would find it. The module's
+// position is where getToken() would put its def count: the lines moved with the module, but
+// on the line it starts on the offset depends on the text before it.
+void Linker::restoreModule(const CachedModule& cached, Module& module) {
+    const CacheModule& h = *cached.header;
+    size_t pos = line_start + current_pos;
+    size_t start = pos;
+    while (start < input_size && isSpace(input_data[start])) start++;
+    module.line = h.line + (linenum - h.startLinenum);
+    if (linenum > 0 && start < line_start + line_length) {
+        module.offset = lineoffset + (start - pos);
+    } else {
+        const void* nl = start > 0 ? memrchr(input_data, '\n', start) : nullptr;
+        module.offset = start - (nl ? static_cast<const char*>(nl) - input_data + 1 : 0) + 1;
+    }
+    module.baseAddress = totalInstructions;
+    module.instructionCount = h.instructionCount;
+    module.complete = true;
+
+    module.defList.reserve(h.defCount);
+    for (uint32_t i = 0; i < h.defCount; i++) {
+        module.defList.push_back({cached.defs[i].name.view(), static_cast<int>(cached.defs[i].value)});
+    }
+    module.useList.reserve(h.useCount);
+    for (uint32_t i = 0; i < h.useCount; i++) {
+        module.useList.push_back(cached.uses[i].view());
+    }
+    module.instructions.reserve(h.storedInstructions);
+    for (uint32_t i = 0; i < h.storedInstructions; i++) {
+        module.instructions.push_back(unpackInstruction(cached.instructions[i]));
+    }
+}
+
+// pass1 over a text input, reusing cached module records whose bytes are unchanged.
+// The cached module after the last one reused, and the one after it, are tried at each
+// module. A module that has to be parsed leaves that position alone, so an edited or
+// inserted module does not lose the modules after it; if its bytes are cached further on,
+// after deleted modules, the search continues from there.
+void Linker::pass1Cached() {
+    size_t pos = 0;
+    size_t next = 0;
+
+    // Cached modules by the hash of their bytes, in cache order
+    std::unordered_map<uint64_t, std::vector<size_t>> byHash;
+    for (size_t k = 0; k < cachedModules.size(); k++) byHash[cachedModules[k].header->hash].push_back(k);
+
+    while (true) {
+        const CachedModule* hit = nullptr;
+        size_t hitIndex = 0;
+        for (size_t k = next; k < cachedModules.size() && k <= next + 1; k++) {
+            if (cacheMatches(cachedModules[k], pos)) {
+                hit = &cachedModules[k];
+                hitIndex = k;
+                break;
+            }
+        }
+        // Let the tokenizer report a machine overflow at its exact position
+        if (hit && static_cast<int64_t>(totalInstructions) + hit->header->instructionCount > machine.machineSize) {
+            hit = nullptr;
+        }
+
+        int startLinenum = linenum;
+        Module module;
+        if (hit) {
+            const CacheModule& h = *hit->header;
+            restoreModule(*hit, module);
+            seekTokenizer(pos + h.length, linenum + (h.endLinenum - h.startLinenum), h.endLineoffset);
+            reusedRecords++;
+            next = hitIndex + 1;
+        } else {
+            if (!parseModule(module)) return;
+            auto found = byHash.find(hashBytes(input_data + pos, line_start + current_pos - pos));
+            if (found != byHash.end()) {
+                auto later = std::lower_bound(found->second.begin(), found->second.end(), next);
+                if (later != found->second.end()) next = *later + 1;
+            }
+        }
+
+        size_t end = line_start + current_pos;
+        moduleSpans.push_back({pos, end, startLinenum, linenum, lineoffset, hit, 0, 0, 0, {}, {}});
+        pos = end;
+
+        modules.push_back(std::move(module));
+        defineModule(modules.back(), modules.size() - 1);
+        if (!modules.back().complete) return;
+
+        if (modules.size() > size_t(machine.maxModules)) {
+            __parseerror(6);
+        }
+    }
+}
+
+bool Linker::writeCache(const char* path) {
+    std::string tmpPath = std::string(path) + ".tmp";
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if (!file) return false;
+
+    // Only complete modules of the input are worth remembering; archive members are not cached
+    size_t count = 0;
+    while (count < moduleSpans.size() && modules[count].complete) count++;
+
+    CacheHeader header = {};
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.moduleCount = count;
+    header.machineSize = machine.machineSize;
+    header.maxModules = machine.maxModules;
+    header.maxDefs = machine.maxDefs;
+    header.maxUses = machine.maxUses;
+    header.operandDigits = machine.operandDigits;
+
+    static const char zeros[8] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    auto put = [&](const void* data, size_t bytes) {
+        if (bytes > 0) ok = ok && fwrite(data, 1, bytes, file) == bytes;
+        if (padded(bytes) != bytes) ok = ok && fwrite(zeros, 1, padded(bytes) - bytes, file) == padded(bytes) - bytes;
+    };
+
+    int firstAddress = 0;
+    for (size_t m = 0; m < count && ok; m++) {
+        const Module& module = modules[m];
+        const ModuleSpan& span = moduleSpans[m];
+
+        std::vector<ObjectDef> defs;
+        for (const Definition& def : module.defList) defs.push_back({SymbolName(def.name), def.value});
+        std::vector<SymbolName> uses;
+        for (std::string_view use : module.useList) uses.push_back(SymbolName(use));
+        std::vector<uint64_t> instructions;
+        for (const Instruction& instr : module.instructions) instructions.push_back(packInstruction(instr));
+        std::string_view output = out.view(span.outputBegin, span.outputEnd);
+
+        CacheModule record = {};
+        record.length = span.end - span.begin;
+        record.hash = hashBytes(input_data + span.begin, record.length);
+        record.relocationKey = span.relocationKey;
+        record.startLinenum = span.startLinenum;
+        record.endLinenum = span.endLinenum;
+        record.endLineoffset = span.endLineoffset;
+        record.line = module.line;
+        record.offset = module.offset;
+        record.instructionCount = module.instructionCount;
+        record.defCount = defs.size();
+        record.useCount = uses.size();
+        record.storedInstructions = instructions.size();
+        record.usedCount = span.usedUses.size();
+        record.outputLength = output.size();
+        std::copy(span.diagnostics, span.diagnostics + Diagnostic::CODES, record.diagnostics);
+
+        put(&record, sizeof(record));
+        put(defs.data(), sizeof(ObjectDef) * defs.size());
+        put(uses.data(), sizeof(SymbolName) * uses.size());
+        put(instructions.data(), sizeof(uint64_t) * instructions.size());
+        put(memoryMap.data() + firstAddress, sizeof(int64_t) * instructions.size());
+        put(span.usedUses.data(), sizeof(uint32_t) * span.usedUses.size());
+        put(output.data(), output.size());
+        firstAddress += instructions.size();
+    }
+
+    // Replace the old cache only once the new one is complete; it may still be mapped
+    if (fclose(file) != 0) ok = false;
+    if (!ok || rename(tmpPath.c_str(), path) != 0) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void Linker::pass1() {
+    totalInstructions = 0;
+
+    if (isObjectInput()) {
+        loadObject();
+        return;
+    }
+
+    if (cacheEnabled) {
+        pass1Cached();
+        return;
+    }
+
+    if (streamFd >= 0) {
+        pass1Streaming();
+        return;
+    }
+
+    while (true) {
+        Module module;
+        if (!parseModule(module)) return;
+
+        modules.push_back(std::move(module));
+        defineModule(modules.back(), modules.size() - 1);
+        if (!modules.back().complete) return;
+
+        if (modules.size() > size_t(machine.maxModules)) {
+            __parseerror(6);
+        }
+    }
+}
+
+// Reused for every module, keeping the capacity
+void clearModule(Module& module) {
+    module.defList.clear();
+    module.useList.clear();
+    module.definedSymbols.clear();
+    module.instructions.clear();
+}
+
+// --stream: pass1 without keeping the modules. Only where each one starts is recorded, and the
+// input pages behind the tokenizer are given back, so memory follows the symbol table and not
+// the size of the program.
+void Linker::pass1Streaming() {
+    Module module;
+    ModuleMark mark = {0, 0, 0};
+    while (true) {
+        clearModule(module);
+        if (!parseModule(module)) return;
+
+        moduleMarks.push_back(mark);
+        defineModule(module, moduleMarks.size() - 1);
+        if (stats) countModule(module, true, true);
+        if (!module.complete) return;
+
+        if (moduleMarks.size() > size_t(machine.maxModules)) {
+            __parseerror(6);
+        }
+        mark = {line_start + current_pos, linenum, lineoffset};
+        releaseInput(mark.pos);
+    }
+}
+
+void Linker::seekModule(const ModuleMark& mark) {
+    if (mark.pos == 0 && mark.line == 0) {
+        // Before the first line, as a fresh tokenizer is
+        next_line_start = line_start = line_length = current_pos = 0;
+        linenum = lineoffset = 0;
+    } else {
+        seekTokenizer(mark.pos, mark.line, mark.offset);
+    }
+}
+
+// Pages are read back from the file if the tokenizer looks behind pos again
+void Linker::releaseInput(size_t pos) {
+    const size_t STREAM_RELEASE = 16 << 20;
+    size_t end = pos & ~size_t(4095);
+    if (end >= releasedInput + STREAM_RELEASE) {
+        madvise(const_cast<char*>(input_data) + releasedInput, end - releasedInput, MADV_DONTNEED);
+        releasedInput = end;
+    }
+}
+
+// --gc-modules: keeps only the modules reachable from the entry modules. A module reaches the
+// module defining each symbol on its uselist and every module an M operand names. The live
+// modules are laid out again in their original order, so R operands and symbol values move
+// with their module's new base; M operands keep naming original module numbers, and so do
+// the warnings.
+void Linker::collectModules(const std::vector<int>& entries) {
+    // After a truncated input the module numbers and base addresses no longer line up
+    if (modules.empty() || !modules.back().complete) return;
+
+    std::vector<size_t> pending;
+    moduleDropped.assign(modules.size(), true);
+    for (int entry : entries) {
+        if (entry < 0 || size_t(entry) >= modules.size()) {
+            throw std::runtime_error("entry module " + std::to_string(entry) + " does not exist");
+        }
+        if (moduleDropped[entry]) {
+            moduleDropped[entry] = false;
+            pending.push_back(entry);
+        }
+    }
+
+    auto reach = [&](size_t m) {
+        if (moduleDropped[m]) {
+            moduleDropped[m] = false;
+            pending.push_back(m);
+        }
+    };
+    while (!pending.empty()) {
+        const Module& module = modules[pending.back()];
+        pending.pop_back();
+        for (std::string_view use : module.useList) {
+            const Symbol* sym = symbolTable.find(SymbolName(use), probeStats());
+            if (sym) reach(sym->definingModule);
+        }
+        for (const Instruction& instr : module.instructions) {
+            int64_t opcode = instr.word / machine.operandBase;
+            int64_t operand = instr.word % machine.operandBase;
+            if (instr.mode == 'M' && opcode < 10 && operand >= 0 && size_t(operand) < modules.size()) {
+                reach(operand);
+            }
+        }
+    }
+
+    std::vector<int> shift(modules.size(), 0);
+    int address = 0;
+    for (size_t m = 0; m < modules.size(); m++) {
+        if (moduleDropped[m]) {
+            droppedModules++;
+            continue;
+        }
+        shift[m] = address - modules[m].baseAddress;
+        modules[m].baseAddress = address;
+        moduleBaseAddresses[m] = address;
+        address += modules[m].instructionCount;
+    }
+    totalInstructions = address;
+
+    for (Symbol& sym : symbolTable) {
+        sym.value += shift[sym.definingModule];
+    }
+}
+
+// Relocates one module into image, which holds its words from the given output address on.
+// Touches no shared state except symbolUsed and found, which each worker owns.
+void Linker::relocate(const Module& module, size_t moduleCount, int address, int64_t* image, OutputWriter& out,
+                      std::vector<char>& symbolUsed, std::vector<Diagnostic>* found, ProbeStats* probes,
+                      std::vector<uint32_t>* usedUses) {
+    const std::vector<std::string_view>& useList = module.useList;
+    int useCount = useList.size();
+    int instructionCount = module.instructions.size();
+    const int64_t base = machine.operandBase;
+    std::vector<bool> usedSymbols(useCount, false);
+
+    // Resolve the uselist once instead of probing the table per E instruction
+    std::vector<int> useSymbols(useCount);
+    for (int i = 0; i < useCount; i++) {
+        useSymbols[i] = symbolTable.indexOf(SymbolName(useList[i]), probes);
+    }
+
+    for (const Instruction& instr : module.instructions) {
+        char addressMode = instr.mode;
+        int64_t instruction = instr.word;
+        int64_t opcode = instruction / base;
+        int64_t operand = instruction % base;
+
+        int64_t word = instruction;
+        const char* error = nullptr;
+        Diagnostic::Code code = Diagnostic::ILLEGAL_OPCODE;
+        int undefinedUse = -1;
+
+        if (opcode >= 10) {
+            word = 10 * base - 1;
+            error = machine.illegalOpcodeError.c_str();
+            code = Diagnostic::ILLEGAL_OPCODE;
+        } else {
+            switch (addressMode) {
+                case 'I':
+                    if (operand >= machine.immediateLimit) {
+                        word = opcode * base + base - 1;
+                        error = machine.illegalImmediateError.c_str();
+                        code = Diagnostic::ILLEGAL_IMMEDIATE;
+                    }
+                    break;
+                case 'A':
+                    if (operand >= machine.machineSize) {
+                        word = opcode * base;
+                        error = " Error: Absolute address exceeds machine size; zero used";
+                        code = Diagnostic::ABSOLUTE_TOO_LARGE;
+                    }
+                    break;
+                case 'R':
+                    if (operand >= instructionCount) {
+                        word = opcode * base + module.baseAddress;
+                        error = " Error: Relative address exceeds module size; relative zero used";
+                        code = Diagnostic::RELATIVE_TOO_LARGE;
+                    } else {
+                        word = opcode * base + operand + module.baseAddress;
+                    }
+                    break;
+                case 'E':
+                    if (operand < 0 || operand >= useCount) {
+                        word = opcode * base;
+                        error = " Error: External operand exceeds length of uselist; treated as relative=0";
+                        code = Diagnostic::EXTERNAL_TOO_LARGE;
+                    } else {
+                        int entry = useSymbols[operand];
+                        usedSymbols[operand] = true;
+                        if (entry < 0) {
+                            word = opcode * base;
+                            undefinedUse = operand;
+                        } else {
+                            symbolUsed[entry] = true;
+                            word = opcode * base + symbolTable[entry].value;
+                        }
+                    }
+                    break;
+                case 'M':
+                    if (static_cast<size_t>(operand) >= moduleBaseAddresses.size()) {
+                        word = opcode * base;
+                        error = " Error: Illegal module operand ; treated as module=0";
+                        code = Diagnostic::ILLEGAL_MODULE;
+                    } else {
+                        word = opcode * base + moduleBaseAddresses[operand];
+                    }
+                    break;
+            }
+        }
+
+        *image++ = word;
+        out.appendPadded(address++, machine.addressWidth);
+        out.append(": ");
+        out.appendPadded(word, machine.wordWidth);
+        if (error) {
+            out.append(error);
+        } else if (undefinedUse >= 0) {
+            out.append(" Error: ");
+            out.append(useList[undefinedUse]);
+            out.append(" is not defined; zero used");
+        }
+        out.append('\n');
+
+        if (found && error) {
+            found->push_back({code, true, int(moduleCount), address - 1, -1, -1, "", error + 1});
+        } else if (found && undefinedUse >= 0) {
+            std::string name(useList[undefinedUse]);
+            found->push_back({Diagnostic::UNDEFINED_SYMBOL, true, int(moduleCount), address - 1, -1, -1, name,
+                              "Error: " + name + " is not defined; zero used"});
+        }
+    }
+
+    if (usedUses) {
+        for (int i = 0; i < useCount; i++) {
+            if (usedSymbols[i]) usedUses->push_back(i);
+        }
+    }
+
+    // A module cut short by end of input never reached its uselist check
+    if (!module.complete) return;
+
+    for (size_t i = 0; i < useList.size(); i++) {
+        if (!usedSymbols[i]) {
+            out.append("Warning: Module ");
+            out.appendInt(moduleCount);
+            out.append(": uselist[");
+            out.appendInt(i);
+            out.append("]=");
+            out.append(useList[i]);
+            out.append(" was not used\n");
+            if (found) {
+                std::string name(useList[i]);
+                found->push_back({Diagnostic::USE_NOT_USED, false, int(moduleCount), -1, -1, -1, name,
+                                  "Warning: Module " + std::to_string(moduleCount) + ": uselist[" +
+                                  std::to_string(i) + "]=" + name + " was not used"});
+            }
+        }
+    }
+}
+
+// Relocates a module, or replays the cached relocation if everything it depends on is unchanged:
+// its address, the values of its uselist symbols and the bases of the modules its M operands
+// name. Its number only matters if the listing warns about an unused uselist entry.
+void Linker::relocateCached(size_t m, int address, std::vector<char>& symbolUsed) {
+    const Module& module = modules[m];
+    ModuleSpan& span = moduleSpans[m];
+    const int64_t base = machine.operandBase;
+
+    std::vector<int> useSymbols(module.useList.size());
+    uint64_t key = hashValue(0, address);
+    for (size_t i = 0; i < module.useList.size(); i++) {
+        useSymbols[i] = symbolTable.indexOf(SymbolName(module.useList[i]), probeStats());
+        key = hashValue(key, useSymbols[i] >= 0 ? symbolTable[useSymbols[i]].value : INT64_MIN);
+    }
+
+    std::vector<char> referenced(module.useList.size(), false);
+    for (const Instruction& instr : module.instructions) {
+        int64_t opcode = instr.word / base;
+        int64_t operand = instr.word % base;
+        if (opcode >= 10) continue;
+        if (instr.mode == 'M') {
+            bool valid = operand >= 0 && size_t(operand) < moduleBaseAddresses.size();
+            key = hashValue(key, valid ? moduleBaseAddresses[operand] : INT64_MIN);
+        } else if (instr.mode == 'E' && operand >= 0 && size_t(operand) < referenced.size()) {
+            referenced[operand] = true;
+        }
+    }
+    if (std::find(referenced.begin(), referenced.end(), false) != referenced.end()) key = hashValue(key, m);
+    span.relocationKey = key;
+    span.outputBegin = out.size();
+
+    const CachedModule* cached = span.cached;
+    if (cached && cached->header->relocationKey == key) {
+        std::copy(cached->words, cached->words + module.instructions.size(), memoryMap.begin() + address);
+        out.append(cached->output);
+        span.usedUses.assign(cached->used, cached->used + cached->header->usedCount);
+        for (uint32_t i : span.usedUses) {
+            if (useSymbols[i] >= 0) symbolUsed[useSymbols[i]] = true;
+        }
+        std::copy(cached->header->diagnostics, cached->header->diagnostics + Diagnostic::CODES, span.diagnostics);
+        for (int code = 0; stats && code < Diagnostic::CODES; code++) {
+            stats->diagnostics[code] += span.diagnostics[code];
+        }
+        reusedRelocations++;
+    } else {
+        // The uselist lookups above are the ones relocate() would count; the diagnostics are
+        // always counted, so a later link can replay them
+        std::vector<Diagnostic> found;
+        relocateModule(m, address, out, symbolUsed, &found, nullptr, &span.usedUses);
+        for (const Diagnostic& d : found) span.diagnostics[d.code]++;
+        if (collectDiagnostics) std::move(found.begin(), found.end(), std::back_inserter(diagnostics));
+    }
+    span.outputEnd = out.size();
+}
+
+// With jobs > 1, contiguous blocks of modules are relocated on a pool of threads,
+// each into its own output buffer; the buffers are then emitted in module order.
+void Linker::pass2(int jobs) {
+    if (streamFd >= 0) {
+        pass2Streaming();
+        return;
+    }
+
+    // Output addresses count the instructions actually read, like the old streaming pass2;
+    // modules dropped by --gc-modules take no space
+    std::vector<int> firstAddress(modules.size() + 1, 0);
+    for (size_t i = 0; i < modules.size(); i++) {
+        firstAddress[i + 1] = firstAddress[i] + (isLive(i) ? modules[i].instructions.size() : 0);
+    }
+    memoryMap.assign(firstAddress.back(), 0);
+    out.reserve(out.size() + size_t(firstAddress.back()) * (machine.addressWidth + machine.wordWidth + 3));
+
+    size_t blockCount = 1;
+    if (jobs > 1 && modules.size() > 1) {
+        blockCount = std::min(modules.size(), static_cast<size_t>(jobs) * 8);
+    }
+
+    std::vector<char> symbolUsed(symbolTable.size(), false);
+    if (cacheEnabled) {
+        for (size_t m = 0; m < modules.size(); m++) {
+            if (m < moduleSpans.size()) {
+                relocateCached(m, firstAddress[m], symbolUsed);
+            } else {
+                relocateModule(m, firstAddress[m], out, symbolUsed, collectDiagnostics ? &diagnostics : nullptr,
+                               probeStats());
+            }
+        }
+    } else if (blockCount == 1) {
+        std::vector<Diagnostic>* found = collectDiagnostics ? &diagnostics : nullptr;
+        for (size_t m = 0; m < modules.size(); m++) {
+            if (isLive(m)) relocateModule(m, firstAddress[m], out, symbolUsed, found, probeStats());
+        }
+    } else {
+        std::vector<OutputWriter> blockOutput(blockCount);
+        std::vector<std::vector<Diagnostic>> blockDiagnostics(collectDiagnostics ? blockCount : 0);
+        std::vector<ProbeStats> workerProbes(stats ? jobs : 0);
+        std::vector<std::vector<char>> workerUsed(jobs, std::vector<char>(symbolTable.size(), false));
+        std::atomic<size_t> nextBlock(0);
+
+        auto worker = [&](int id) {
+            size_t block;
+            while ((block = nextBlock++) < blockCount) {
+                size_t first = modules.size() * block / blockCount;
+                size_t last = modules.size() * (block + 1) / blockCount;
+                for (size_t m = first; m < last; m++) {
+                    if (isLive(m)) {
+                        relocateModule(m, firstAddress[m], blockOutput[block], workerUsed[id],
+                                       collectDiagnostics ? &blockDiagnostics[block] : nullptr,
+                                       stats ? &workerProbes[id] : nullptr);
+                    }
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int id = 1; id < jobs; id++) threads.emplace_back(worker, id);
+        worker(0);
+        for (std::thread& t : threads) t.join();
+
+        for (const OutputWriter& block : blockOutput) out.append(block);
+        for (std::vector<Diagnostic>& found : blockDiagnostics) {
+            std::move(found.begin(), found.end(), std::back_inserter(diagnostics));
+        }
+        for (const ProbeStats& probes : workerProbes) {
+            stats->symbols.lookups += probes.lookups;
+            stats->symbols.probes += probes.probes;
+        }
+        for (const std::vector<char>& used : workerUsed) {
+            for (size_t i = 0; i < used.size(); i++) symbolUsed[i] |= used[i];
+        }
+    }
+
+    markUsed(symbolUsed);
+}
+
+// --stream: parses each module again where pass1 found it and relocates it into a scratch image.
+// The output goes to streamFd in chunks as it fills.
+void Linker::pass2Streaming() {
+    const size_t STREAM_CHUNK = 1 << 20;
+    std::vector<char> symbolUsed(symbolTable.size(), false);
+    std::vector<Diagnostic>* found = collectDiagnostics ? &diagnostics : nullptr;
+    std::vector<int64_t> image;
+    Module module;
+    int total = totalInstructions;
+    int address = 0;
+
+    releasedInput = 0;
+    for (size_t m = 0; m < moduleMarks.size(); m++) {
+        clearModule(module);
+        seekModule(moduleMarks[m]);
+        totalInstructions = address;
+        parseModule(module);
+
+        image.resize(module.instructions.size());
+        relocate(module, m, address, image.data(), out, symbolUsed, found, probeStats());
+        address += module.instructions.size();
+
+        if (out.size() >= STREAM_CHUNK) out.flush(streamFd);
+        releaseInput(line_start + current_pos);
+    }
+    totalInstructions = total;
+
+    markUsed(symbolUsed);
+}
+
+// Ends the memory map and warns about the symbols no relocation used
+void Linker::markUsed(const std::vector<char>& symbolUsed) {
+    for (size_t i = 0; i < symbolUsed.size(); i++) {
+        if (symbolUsed[i]) symbolTable[i].isUsed = true;
+    }
+
+    out.append('\n');  // Add a blank line after Memory Map
+
+    for (int index : symbolTable.sorted()) {
+        const Symbol& sym = symbolTable[index];
+        if (sym.isDefined && !sym.isUsed && isLive(sym.definingModule)) {
+            warnings.push_back("Warning: Module " + std::to_string(sym.definingModule) + ": " + std::string(sym.name.view()) + " was defined but never used");
+            if (collectDiagnostics) {
+                diagnostics.push_back({Diagnostic::DEFINED_NOT_USED, false, sym.definingModule, -1, -1, -1,
+                                       std::string(sym.name.view()), warnings.back()});
+            }
+        }
+    }
+}
+
+void Linker::printSymbolTable() {
+    out.append("Symbol Table\n");
+    for (int index : symbolTable.sorted()) {
+        const Symbol& sym = symbolTable[index];
+        if (!isLive(sym.definingModule)) continue;
+        out.append(sym.name.view());
+        out.append('=');
+        out.appendInt(sym.value);
+        if (sym.multiplyDefined) {
+            out.append(" Error: This variable is multiple times defined; first value used");
+            if (collectDiagnostics) {
+                diagnostics.push_back({Diagnostic::MULTIPLY_DEFINED, true, sym.definingModule, -1, -1, -1,
+                                       std::string(sym.name.view()),
+                                       "Error: This variable is multiple times defined; first value used"});
+            }
+        }
+        out.append('\n');
+    }
+    out.append('\n');  // Add a blank line after Symbol Table
+}
+
+void Linker::printWarnings() {
+    for (const auto& warning : warnings) {
+        out.append(warning);
+        out.append('\n');
+    }
+    out.append('\n');  // Add a blank line after warnings
+}
+
+// Everything after pass1: the warnings so far, the symbol table, the memory map and its warnings
+void Linker::listing(int jobs) {
+    printWarnings();
+    printSymbolTable();
+
+    warnings.clear();
+
+    out.append("Memory Map\n");
+    pass2(jobs);
+    printWarnings();
+}
+
+// Tokens are counted from the modules tokenized in this link; modules taken from an object,
+// an archive or the cache were never tokenized. Modes count the instructions linked.
+void Linker::countStats() {
+    size_t inputModules = modules.size() - pulledMembers;
+    for (size_t m = 0; m < modules.size(); m++) {
+        bool tokenized = !isObjectInput() && m < inputModules &&
+                         !(m < moduleSpans.size() && moduleSpans[m].cached);
+        countModule(modules[m], tokenized, isLive(m));
+    }
+    for (const Diagnostic& d : diagnostics) stats->diagnostics[d.code]++;
+}
+
+// --stream counts each module in pass1, as it is dropped
+void Linker::countModule(const Module& module, bool tokenized, bool linked) {
+    if (tokenized) {
+        stats->tokens += 3 + 2 * module.defList.size() + module.useList.size() + 2 * module.instructions.size();
+    }
+    if (!linked) return;
+    for (const Instruction& instr : module.instructions) {
+        int mode = modeIndex(instr.mode);
+        if (mode >= 0) stats->modes[mode]++;
+    }
+}
+
+const char* Diagnostic::name(Code code) {
+    static const char* names[CODES] = {
+        "PARSE_ERROR", "INVALID_INPUT", "REDEFINED_SYMBOL", "DEFINITION_TOO_LARGE", "MULTIPLY_DEFINED",
+        "ILLEGAL_OPCODE", "ILLEGAL_IMMEDIATE", "ABSOLUTE_TOO_LARGE", "RELATIVE_TOO_LARGE",
+        "EXTERNAL_TOO_LARGE", "UNDEFINED_SYMBOL", "ILLEGAL_MODULE", "USE_NOT_USED", "DEFINED_NOT_USED"
+    };
+    return names[code];
+}
+
+LinkResult linkBuffer(std::string_view input, const LinkOptions& options) {
+    LinkResult result;
+    Linker linker;
+    linker.machine = options.machine;
+    if (!setupMachine(linker.machine)) {
+        result.diagnostics.push_back({Diagnostic::INVALID_INPUT, true, -1, -1, -1, -1, "", "Invalid machine profile"});
+        return result;
+    }
+    linker.setInput(input);
+    linker.collectDiagnostics = true;
+
+    try {
+        linker.pass1();
+        linker.resolveArchives();
+        if (!options.gcEntries.empty()) linker.collectModules(options.gcEntries);
+        linker.listing(std::max(options.jobs, 1));
+        result.ok = true;
+    } catch (const ParseError&) {
+    } catch (const std::exception& e) {
+        linker.diagnostics.push_back({Diagnostic::INVALID_INPUT, true, -1, -1, -1, -1, "", e.what()});
+    }
+
+    for (int index : linker.symbolTable.sorted()) {
+        const Symbol& sym = linker.symbolTable[index];
+        if (!linker.isLive(sym.definingModule)) continue;
+        result.symbols.push_back({std::string(sym.name.view()), sym.value, sym.definingModule,
+                                  sym.multiplyDefined, sym.isUsed});
+    }
+    result.memoryMap = std::move(linker.memoryMap);
+    result.diagnostics = std::move(linker.diagnostics);
+    result.listing = linker.out.release();
+    return result;
+}
@@ -0,0 +1,647 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+#include <climits>
+#include <cerrno>
+#include <string_view>
+#include <unistd.h>
+
+// Limits and word layout of the target machine. The defaults are the classic
+// 512-word machine with 4-digit instructions (opcode*1000 + operand);
+// setupMachine() checks the configurable fields and derives the remaining ones.
+struct MachineProfile {
+    int machineSize = 512;
+    int maxModules = 128;
+    int maxDefs = 16;                 // per module
+    int maxUses = 16;                 // per module
+    int operandDigits = 3;
+
+    int64_t operandBase;              // 10^operandDigits
+    int64_t immediateLimit;           // first illegal immediate operand
+    int64_t maxWord;                  // largest word accepted by the parser
+    int64_t minWord;
+    int addressWidth;                 // digits printed for an address
+    int wordWidth;                    // digits printed for a word
+    std::string illegalOpcodeError;
+    std::string illegalImmediateError;
+};
+
+bool setupMachine(MachineProfile& machine);
+
+// Maps a whole file read-only; an empty file yields size 0 and no mapping
+bool mapFile(const char* path, const char*& data, size_t& size);
+
+// readSymbol() caps names at 16 characters, so they are kept inline and zero padded
+const int MAX_SYMBOL_LENGTH = 16;
+
+struct SymbolName {
+    char bytes[MAX_SYMBOL_LENGTH];
+
+    SymbolName() { memset(bytes, 0, sizeof(bytes)); }
+    explicit SymbolName(std::string_view name) {
+        memset(bytes, 0, sizeof(bytes));
+        memcpy(bytes, name.data(), std::min(name.size(), sizeof(bytes)));
+    }
+
+    std::string_view view() const { return std::string_view(bytes, strnlen(bytes, sizeof(bytes))); }
+    bool operator==(const SymbolName& other) const { return memcmp(bytes, other.bytes, sizeof(bytes)) == 0; }
+    bool operator<(const SymbolName& other) const { return memcmp(bytes, other.bytes, sizeof(bytes)) < 0; }
+
+    uint64_t hash() const {
+        uint64_t lo, hi;
+        memcpy(&lo, bytes, 8);
+        memcpy(&hi, bytes + 8, 8);
+        uint64_t h = lo * 0x9E3779B97F4A7C15ull ^ hi * 0xC2B2AE3D27D4EB4Full;
+        return h ^ (h >> 29);
+    }
+};
+
+struct Symbol {
+    SymbolName name;
+    int value;
+    bool isDefined;
+    bool isUsed;
+    bool multiplyDefined;
+    int definingModule;
+};
+
+// Symbol table traffic, counted for the -T report by the lookups that are given one
+struct ProbeStats {
+    size_t lookups = 0;
+    size_t probes = 0;              // slots looked at
+};
+
+// Open-addressing (linear probing) index over an arena of symbols kept in definition order.
+// The table grows as needed; alphabetical order is computed once, for printing.
+class SymbolTable {
+private:
+    std::vector<Symbol> symbols;
+    std::vector<int> slots;         // index into symbols, -1 if empty
+    std::vector<int> sortedOrder;
+
+    size_t slotFor(const SymbolName& name, ProbeStats* stats = nullptr) const {
+        size_t mask = slots.size() - 1;
+        size_t home = name.hash() & mask;
+        size_t slot = home;
+        while (slots[slot] >= 0 && !(symbols[slots[slot]].name == name)) {
+            slot = (slot + 1) & mask;
+        }
+        if (stats) {
+            stats->lookups++;
+            stats->probes += ((slot - home) & mask) + 1;
+        }
+        return slot;
+    }
+
+    void grow() {
+        std::vector<int> old(slots.size() * 2, -1);
+        slots.swap(old);
+        for (size_t i = 0; i < symbols.size(); i++) {
+            slots[slotFor(symbols[i].name)] = i;
+        }
+    }
+
+public:
+    SymbolTable() : slots(64, -1) {}
+
+    int indexOf(const SymbolName& name, ProbeStats* stats = nullptr) const {
+        return slots[slotFor(name, stats)];
+    }
+
+    Symbol* find(const SymbolName& name, ProbeStats* stats = nullptr) {
+        int index = indexOf(name, stats);
+        return index >= 0 ? &symbols[index] : nullptr;
+    }
+
+    // The name must not be present yet; the pointer is valid until the next insert
+    Symbol* insert(const Symbol& symbol) {
+        if ((symbols.size() + 1) * 2 > slots.size()) grow();
+        slots[slotFor(symbol.name)] = symbols.size();
+        symbols.push_back(symbol);
+        sortedOrder.clear();
+        return &symbols.back();
+    }
+
+    size_t size() const { return symbols.size(); }
+    std::vector<Symbol>::iterator begin() { return symbols.begin(); }
+    std::vector<Symbol>::iterator end() { return symbols.end(); }
+
+    const std::vector<int>& sorted() {
+        if (sortedOrder.size() != symbols.size()) {
+            sortedOrder.resize(symbols.size());
+            for (size_t i = 0; i < symbols.size(); i++) sortedOrder[i] = i;
+            std::sort(sortedOrder.begin(), sortedOrder.end(),
+                      [this](int a, int b) { return symbols[a].name < symbols[b].name; });
+        }
+        return sortedOrder;
+    }
+
+    Symbol& operator[](int index) { return symbols[index]; }
+};
+
+// One module as tokenized by pass1, so pass2 can relocate without re-reading the input
+struct Instruction {
+    char mode;
+    int64_t word;
+};
+
+// Position of an addressing mode in "MARIE", or -1 if it is none of them
+inline int modeIndex(char mode) {
+    switch (mode) {
+        case 'M': return 0;
+        case 'A': return 1;
+        case 'R': return 2;
+        case 'I': return 3;
+        case 'E': return 4;
+        default: return -1;
+    }
+}
+
+struct Definition {
+    std::string_view name;
+    int value;                    // relative to the module
+};
+
+struct Module {
+    int line;                     // position of the def count, for diagnostics
+    int offset;
+    int baseAddress;
+    int instructionCount;         // as declared; only meaningful once complete
+    bool complete;                // false if the input ended inside this module
+    std::vector<Definition> defList;
+    std::vector<std::string_view> useList;
+    std::vector<int> definedSymbols;  // symbol table indices first defined here, in name order
+    std::vector<Instruction> instructions;
+};
+
+// A link's whole output is formatted into one growing buffer and handed to the kernel
+// with a single write() at the end; the integer formatting mirrors
+// std::setfill('0') << std::setw(width) so the output is byte-identical.
+class OutputWriter {
+private:
+    std::string buffer;
+    size_t flushed = 0;
+
+public:
+    OutputWriter() { buffer.reserve(1 << 16); }
+
+    void append(std::string_view text) { buffer.append(text.data(), text.size()); }
+    void append(char c) { buffer.push_back(c); }
+
+    // Right-aligned and zero filled like iostreams, so the fill goes before any sign
+    void appendPadded(long long value, int width) {
+        char digits[24];
+        char* end = digits + sizeof(digits);
+        char* p = end;
+        unsigned long long magnitude = value < 0 ? 0ull - value : value;
+        do {
+            *--p = '0' + magnitude % 10;
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (value < 0) *--p = '-';
+        for (int len = end - p; len < width; len++) buffer.push_back('0');
+        buffer.append(p, end - p);
+    }
+
+    void appendInt(long long value) { appendPadded(value, 0); }
+
+    void append(const OutputWriter& other) { buffer.append(other.buffer); }
+
+    size_t size() const { return buffer.size(); }
+    size_t total() const { return flushed + buffer.size(); }    // including what was flushed
+    void reserve(size_t bytes) { buffer.reserve(bytes); }
+    std::string_view view(size_t from, size_t to) const { return std::string_view(buffer).substr(from, to - from); }
+    std::string release() { return std::move(buffer); }
+
+    void flush(int fd = STDOUT_FILENO) {
+        const char* data = buffer.data();
+        size_t left = buffer.size();
+        while (left > 0) {
+            ssize_t n = write(fd, data, left);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            data += n;
+            left -= n;
+        }
+        flushed += buffer.size();
+        buffer.clear();
+    }
+};
+
+// Thrown once the parse error message is in the output; the link stops there
+struct ParseError {};
+
+inline bool isSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+inline bool isAlpha(char c) {
+    return std::isalpha(static_cast<unsigned char>(c));
+}
+
+inline bool isAlnum(char c) {
+    return std::isalnum(static_cast<unsigned char>(c));
+}
+
+// Character classification for the tokenizer, 64 input bytes at a time: bit i of spaces is
+// isSpace(p[i]) and bit i of alnums is isAlnum(p[i]). Bytes at or past `readable` count as
+// spaces, like the virtual newline at the end of the input. The widest version the CPU
+// supports is picked at startup; the scalar scanner has none and tests one byte at a time.
+struct Scanner {
+    const char* name;
+    void (*classify)(const char* p, size_t readable, uint64_t& spaces, uint64_t& alnums);
+};
+
+// The scanner all links use; it starts as the widest one the CPU supports
+extern Scanner scanner;
+
+// "auto" picks the widest scanner the CPU supports; returns false for an unknown or unsupported name
+bool selectScanner(const char* name);
+
+// Binary relocatable object: the modules of one text input after pass1 has validated them.
+// Layout, in host byte order, every section 8-byte aligned:
+//   ObjectHeader, ObjectModule[moduleCount], ObjectDef[defCount],
+//   SymbolName[useCount] (all uselists), uint64_t[instructionCount] (packed instructions)
+// Each module's entries are consecutive within every section, in module order.
+const char OBJECT_MAGIC[8] = {'\177', 'L', 'N', 'K', 'O', 'B', 'J', '1'};
+const uint32_t OBJECT_VERSION = 1;
+
+struct ObjectHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t moduleCount;
+    uint64_t defCount;
+    uint64_t useCount;
+    uint64_t instructionCount;
+};
+
+struct ObjectModule {
+    int32_t line;
+    int32_t offset;
+    uint32_t defCount;
+    uint32_t useCount;
+    uint32_t storedInstructions;      // instruction records that follow
+    int32_t instructionCount;         // as declared in the source
+    uint32_t complete;
+    uint32_t reserved;
+};
+
+struct ObjectDef {
+    SymbolName name;
+    int64_t value;
+};
+
+// Mode in the top byte, word sign-extended from the low 56 bits
+const int64_t PACKED_WORD_LIMIT = int64_t(1) << 55;
+
+inline uint64_t packInstruction(const Instruction& instr) {
+    return (uint64_t(uint8_t(instr.mode)) << 56) | (uint64_t(instr.word) & ((uint64_t(1) << 56) - 1));
+}
+
+inline Instruction unpackInstruction(uint64_t packed) {
+    int64_t word = int64_t(packed << 8) >> 8;
+    return {char(packed >> 56), word};
+}
+
+// The sections of a mapped object image, after checking that their sizes add up
+struct ObjectImage {
+    ObjectHeader header;
+    const ObjectModule* moduleRecords;
+    const ObjectDef* defs;
+    const SymbolName* uses;
+    const uint64_t* instructions;
+};
+
+bool openObject(const char* data, size_t size, ObjectImage& image);
+
+// Archive: an object image preceded by an index of the symbols its modules define.
+// Layout: ArchiveHeader, ArchiveEntry[indexCount] sorted by name, then the object image.
+// Each symbol maps to the first module that defines it, matching first-definition-wins.
+const char ARCHIVE_MAGIC[8] = {'\177', 'L', 'N', 'K', 'A', 'R', 'C', '1'};
+const uint32_t ARCHIVE_VERSION = 1;
+
+struct ArchiveHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t indexCount;
+};
+
+struct ArchiveEntry {
+    SymbolName name;
+    uint32_t module;
+    uint32_t reserved;
+};
+
+// An archive given with -l, shared read-only by all links. Members are decoded only when
+// pulled into a link.
+struct Archive {
+    ObjectImage object;
+    const ArchiveEntry* index;
+    uint32_t indexCount;
+    std::vector<size_t> defStart;           // per member, offsets into the object's sections
+    std::vector<size_t> useStart;
+    std::vector<size_t> instructionStart;
+
+    int lookup(const SymbolName& name) const {
+        const ArchiveEntry* end = index + indexCount;
+        const ArchiveEntry* entry = std::lower_bound(index, end, name,
+            [](const ArchiveEntry& e, const SymbolName& n) { return e.name < n; });
+        return entry != end && entry->name == name ? int(entry->module) : -1;
+    }
+};
+
+// The archives every link searches, in -l order
+extern std::vector<Archive> archives;
+
+bool openArchive(const char* path, Archive& archive);
+
+// One error or warning of a link, as the listing words it (text, without the newline), and
+// what it is about; fields that do not apply are -1 or empty. Collected in listing order;
+// a parse error leaves only itself in the listing, after the pass1 warnings found before it.
+struct Diagnostic {
+    enum Code {
+        PARSE_ERROR,                // line and offset of the bad token; the link stopped there
+        INVALID_INPUT,              // a damaged object or an invalid machine profile
+        REDEFINED_SYMBOL,
+        DEFINITION_TOO_LARGE,
+        MULTIPLY_DEFINED,
+        ILLEGAL_OPCODE,
+        ILLEGAL_IMMEDIATE,
+        ABSOLUTE_TOO_LARGE,
+        RELATIVE_TOO_LARGE,
+        EXTERNAL_TOO_LARGE,
+        UNDEFINED_SYMBOL,
+        ILLEGAL_MODULE,
+        USE_NOT_USED,
+        DEFINED_NOT_USED
+    };
+    static const int CODES = DEFINED_NOT_USED + 1;
+    static const char* name(Code code);
+
+    Code code;
+    bool error;                     // false for warnings
+    int module = -1;
+    int address = -1;               // output address of the instruction
+    int line = -1;
+    int offset = -1;
+    std::string symbol;
+    std::string text;
+};
+
+// Incremental relinking (--cache). For every module of the previous link the cache keeps the
+// byte range it was parsed from (from the end of the previous module to the end of its last
+// token), the tokenizer state around it, its record, and its relocated words and output.
+// A module whose bytes are unchanged is taken from the cache without tokenizing; its
+// relocation is reused too unless its address, a uselist value or the base of a module one of
+// its M operands names moved.
+// Layout: CacheHeader, then per module a CacheModule followed by ObjectDef[defCount],
+// SymbolName[useCount], uint64_t[storedInstructions] packed instructions,
+// int64_t[storedInstructions] relocated words, uint32_t[usedCount] used uselist slots and
+// outputLength bytes of output, each padded to 8 bytes. A replayed relocation adds the
+// diagnostics its module had, by code, to the -T counters.
+const char CACHE_MAGIC[8] = {'\177', 'L', 'N', 'K', 'C', 'A', 'C', 'H'};
+const uint32_t CACHE_VERSION = 3;
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t moduleCount;
+    int32_t machineSize;
+    int32_t maxModules;
+    int32_t maxDefs;
+    int32_t maxUses;
+    int32_t operandDigits;
+    uint32_t reserved;
+};
+
+struct CacheModule {
+    uint64_t length;
+    uint64_t hash;
+    uint64_t relocationKey;
+    int32_t startLinenum;
+    int32_t endLinenum;
+    int32_t endLineoffset;
+    int32_t line;
+    int32_t offset;
+    int32_t instructionCount;
+    uint32_t defCount;
+    uint32_t useCount;
+    uint32_t storedInstructions;
+    uint32_t usedCount;
+    uint64_t outputLength;
+    uint32_t diagnostics[Diagnostic::CODES];
+};
+
+struct CachedModule {
+    const CacheModule* header;
+    const ObjectDef* defs;
+    const SymbolName* uses;
+    const uint64_t* instructions;
+    const int64_t* words;
+    const uint32_t* used;
+    std::string_view output;
+};
+
+// Where each module of this link came from, and what the next cache needs to know about it
+struct ModuleSpan {
+    size_t begin;
+    size_t end;
+    int startLinenum;
+    int endLinenum;
+    int endLineoffset;
+    const CachedModule* cached;       // source of the record, if it was reused
+    uint64_t relocationKey;
+    size_t outputBegin;
+    size_t outputEnd;
+    std::vector<uint32_t> usedUses;
+    uint32_t diagnostics[Diagnostic::CODES];   // found by relocating the module, by code
+};
+
+// --stream: where a module's text starts, for pass2 to parse it again
+struct ModuleMark {
+    size_t pos;                     // 0 for the first module, else the end of the previous one
+    int line;
+    int offset;
+};
+
+uint64_t hashBytes(const char* data, size_t size, uint64_t h = 0xcbf29ce484222325ull);
+uint64_t hashValue(uint64_t h, int64_t value);
+
+inline size_t padded(size_t bytes) {
+    return (bytes + 7) & ~size_t(7);
+}
+
+// Counters for the -T report. Symbol lookups and the diagnostics of relocations replayed from
+// the cache are counted as the link goes, and only by a Linker that has stats; the rest is
+// derived afterwards by Linker::countStats().
+struct LinkStats {
+    ProbeStats symbols;
+    size_t tokens = 0;
+    size_t modes[5] = {};                       // instructions linked, by mode in "MARIE" order
+    size_t diagnostics[Diagnostic::CODES] = {};
+};
+
+// One link: the input, the tables pass1 builds from it and the formatted output.
+// Links share only the scanner and the archives, which are read-only once main() has set
+// them up, so independent inputs can be linked concurrently, one Linker each.
+class Linker {
+public:
+    MachineProfile machine;         // set up by setupMachine()
+
+    int linenum = 0;
+    int lineoffset = 0;
+    int totalInstructions = 0;
+
+    // The input is mapped read-only, or borrowed from the caller; tokens are views into it
+    // and stay valid until the Linker is destroyed. The current line is [line_start, line_start + line_length),
+    // where the last character is the line's '\n' (or a virtual one if the file lacks it).
+    const char* input_data = nullptr;
+    size_t input_size = 0;
+    bool inputMapped = false;
+    size_t next_line_start = 0;
+    size_t line_start = 0;
+    size_t line_length = 0;
+    size_t current_pos = 0;
+
+    // Whitespace and alphanumeric bitmaps of the 64 input bytes from maskBase
+    size_t maskBase = SIZE_MAX;
+    uint64_t spaceBits = 0;
+    uint64_t alnumBits = 0;
+
+    SymbolTable symbolTable;
+    std::vector<Module> modules;
+    std::vector<int> moduleBaseAddresses;
+    std::vector<int64_t> memoryMap;
+    std::vector<std::string> warnings;
+    OutputWriter out;
+
+    bool collectDiagnostics = false;
+    std::vector<Diagnostic> diagnostics;
+    LinkStats* stats = nullptr;
+
+    std::vector<std::vector<char>> archivePulled;   // per archive, members already in this link
+    size_t pulledMembers = 0;
+
+    bool cacheEnabled = false;
+    const char* cacheData = nullptr;    // the mapped cache file the cached modules point into
+    size_t cacheSize = 0;
+    std::vector<CachedModule> cachedModules;
+    std::vector<ModuleSpan> moduleSpans;
+    size_t reusedRecords = 0;
+    size_t reusedRelocations = 0;
+
+    std::vector<char> moduleDropped;    // per module, by --gc-modules; empty if nothing was collected
+    size_t droppedModules = 0;
+
+    // --stream: pass1 keeps only where each module starts, not its instructions, and pass2
+    // parses each one again and writes its output to streamFd as it goes
+    int streamFd = -1;
+    std::vector<ModuleMark> moduleMarks;
+    size_t releasedInput = 0;           // input pages before this are given back
+
+    Linker() = default;
+    Linker(const Linker&) = delete;
+    Linker& operator=(const Linker&) = delete;
+    ~Linker();
+
+    bool open(const char* path) { return inputMapped = mapFile(path, input_data, input_size); }
+    void setInput(std::string_view input) {
+        input_data = input.data();
+        input_size = input.size();
+    }
+
+    void __parseerror(int errcode);
+
+    void classifyAt(size_t pos);
+    size_t scanTo(size_t pos, size_t limit, bool space);
+    bool getToken(std::string_view& token);
+    bool readInt(int& value);
+    bool readWord(int64_t& value);
+    std::string_view readSymbol();
+    char readMARIE();
+    bool parseModule(Module& module);
+    void defineModule(Module& module, int moduleCount);
+
+    bool isObjectInput();
+    bool writeObjectImage(FILE* file, std::string& problem);
+    bool writeObject(const char* path, std::string& problem);
+    Module objectModule(const ObjectModule& record, const ObjectDef* defs, const SymbolName* uses,
+                        const uint64_t* instructions);
+    void loadObject();
+
+    bool isArchiveInput();
+    bool writeArchive(const char* path, std::string& problem);
+    void resolveArchives();
+
+    void loadCache(const char* path);
+    bool cacheMatches(const CachedModule& cached, size_t pos);
+    void seekTokenizer(size_t pos, int line, int offset);
+    void restoreModule(const CachedModule& cached, Module& module);
+    void pass1Cached();
+    bool writeCache(const char* path);
+
+    void pass1();
+    void pass1Streaming();
+    void seekModule(const ModuleMark& mark);
+    void releaseInput(size_t pos);
+    size_t moduleCount() const { return streamFd >= 0 ? moduleMarks.size() : modules.size(); }
+    void collectModules(const std::vector<int>& entries);
+    bool isLive(size_t m) const { return moduleDropped.empty() || !moduleDropped[m]; }
+    void relocate(const Module& module, size_t moduleCount, int address, int64_t* image, OutputWriter& out,
+                  std::vector<char>& symbolUsed, std::vector<Diagnostic>* found = nullptr,
+                  ProbeStats* probes = nullptr, std::vector<uint32_t>* usedUses = nullptr);
+    // pass1's module m, into its slice of memoryMap
+    void relocateModule(size_t m, int address, OutputWriter& out, std::vector<char>& symbolUsed,
+                        std::vector<Diagnostic>* found = nullptr, ProbeStats* probes = nullptr,
+                        std::vector<uint32_t>* usedUses = nullptr) {
+        relocate(modules[m], m, address, memoryMap.data() + address, out, symbolUsed, found, probes, usedUses);
+    }
+    void relocateCached(size_t m, int address, std::vector<char>& symbolUsed);
+    void pass2(int jobs);
+    void pass2Streaming();
+    void markUsed(const std::vector<char>& symbolUsed);
+    void printSymbolTable();
+    void printWarnings();
+    void listing(int jobs);
+    void countStats();
+    void countModule(const Module& module, bool tokenized, bool linked);
+    ProbeStats* probeStats() { return stats ? &stats->symbols : nullptr; }
+};
+
+// In-memory linking for embedding: the input is a text or object image already in memory,
+// and the result carries everything the listing shows, with no file or console I/O.
+// Links are independent, so concurrent calls are fine once the archives are set up.
+struct LinkOptions {
+    MachineProfile machine;
+    std::vector<int> gcEntries;     // like --gc-modules; empty links every module
+    int jobs = 1;
+};
+
+struct LinkedSymbol {
+    std::string name;
+    int value;
+    int module;                     // the defining one
+    bool multiplyDefined;
+    bool used;
+};
+
+struct LinkResult {
+    bool ok = false;                // false if the link stopped at a parse error or bad input
+    std::vector<LinkedSymbol> symbols;      // in name order
+    std::vector<int64_t> memoryMap;         // relocated words by output address
+    std::vector<Diagnostic> diagnostics;
+    std::string listing;                    // the text the command line linker prints
+};
+
+LinkResult linkBuffer(std::string_view input, const LinkOptions& options = LinkOptions());
+
+#endif
@@ -0,0 +1,77 @@
+#!/bin/bash
+
+# Event-queue benchmark: simulates generated inputs of increasing process count
+# with each event queue, compiled per scheduler kind (static) or through the
+# virtual interfaces (-V), and reports the events/sec of the scheduler's -T report.
+# Every process's arrival is queued up front, so the queue holds about as many
+# events as there are processes still to arrive.
+
+usage() {
+    [[ "${1}" == "" ]] || echo "${1}"
+    echo "usage: $0 <scheduler+optionalargs>"
+    echo "  SIZES=\"10k 1M ...\"  process counts to simulate (default: ${SIZES})"
+    echo "  QUEUES=\"heap ...\"   event queues to compare (default: ${QUEUES})"
+    echo "  DISPATCH=\"static virtual\"  simulation loops to compare (default: ${DISPATCH})"
+    echo "  SCHED=spec          scheduler specification (default: ${SCHED})"
+    echo "  DATA=dir            where the generated inputs are kept (default: ${DATA})"
+    echo "  REPEAT=n            runs per size and queue, best kept (default: ${REPEAT})"
+    echo "e.g. SIZES=\"1M\" SCHED=E4:8 $0 ./sched"
+    exit
+}
+
+SIZES=${SIZES:-"10k 1M 10M"}
+QUEUES=${QUEUES:-"heap calendar"}
+DISPATCH=${DISPATCH:-"static virtual"}
+SCHED=${SCHED:-F}
+DATA=${DATA:-bench-data}
+REPEAT=${REPEAT:-3}
+RFILE=${RFILE:-$(dirname $0)/rfile}
+
+[[ ${#} -lt 1 ]] && usage ""
+PROG=${1}
+shift 1
+SIM="${PROG} $*"
+
+[[ ! -x ${PROG} ]] && echo "program <$PROG> is not executable" && exit
+
+mkdir -p ${DATA}
+
+# one process every 50 time units on average, about as much as it needs the CPU:
+# total cpu 1-100, cpu bursts 1-20, io bursts 1-50
+generate() {
+    local input=${DATA}/procs-${1}
+    if [[ ! -f ${input} ]]; then
+        awk -v size=${1} 'BEGIN {
+            n = size + 0
+            if (size ~ /[kK]$/) n *= 1000
+            if (size ~ /[mM]$/) n *= 1000000
+            srand(1)
+            for (i = 0; i < n; i++)
+                printf "%d %d %d %d\n", int(i * 50 + rand() * 50), 1 + int(rand() * 100),
+                       1 + int(rand() * 20), 1 + int(rand() * 50)
+        }' > ${input}
+    fi
+    echo ${input}
+}
+
+echo "sched=<${SIM} -s${SCHED}>"
+printf "%8s %10s %8s %12s %10s %14s\n" procs queue dispatch events sim_ms events/s
+
+for size in ${SIZES}; do
+    INPUT=$(generate ${size})
+    for queue in ${QUEUES}; do
+    for dispatch in ${DISPATCH}; do
+        FLAGS="-T -q${queue}"
+        [[ ${dispatch} == virtual ]] && FLAGS="${FLAGS} -V"
+        best=""
+        for r in $(seq 1 ${REPEAT}); do
+            line=$(${SIM} ${FLAGS} -s${SCHED} ${INPUT} ${RFILE} 2>&1 >/dev/null |
+                   awk '/^simulation:/ {print $5, $2}')
+            [[ "${line}" == "" ]] && echo "simulation of ${INPUT} failed" && exit 1
+            if [[ "${best}" == "" ]] || awk "BEGIN {exit !(${line%% *} < ${best%% *})}"; then best=${line}; fi
+        done
+        echo ${best} | awk -v size=${size} -v queue=${queue} -v dispatch=${dispatch} '{
+            printf "%8s %10s %8s %12d %10.1f %14.0f\n", size, queue, dispatch, $2, $1, $2 * 1000 / $1 }'
+    done
+    done
+done
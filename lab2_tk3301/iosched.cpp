@@ -4,9 +4,98 @@
 #include <vector>
 #include <string>
 #include <getopt.h>
+#include <sys/resource.h>
 #include <cstdlib>
 #include <cstring>
 #include <stack>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+#include <type_traits>
+#include <new>
+#include <cstdint>
+
+// Heap allocations, for the -T report. They are only counted in builds with
+// -DCOUNT_ALLOCATIONS, which replace the global operator new and delete; the library's
+// array, nothrow and sized forms forward to these. The replacements stay out of line so
+// the compiler never pairs an inlined free() with operator new.
+static size_t heap_allocations = 0;
+
+#ifdef COUNT_ALLOCATIONS
+const bool counting_allocations = true;
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    heap_allocations++;
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void* operator new(size_t size, std::align_val_t align) {
+    heap_allocations++;
+    size_t alignment = static_cast<size_t>(align);
+    size_t bytes = (size + alignment - 1) / alignment * alignment;  // aligned_alloc wants a multiple
+    if (void* p = aligned_alloc(alignment, bytes ? bytes : alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::align_val_t) noexcept { free(p); }
+#else
+const bool counting_allocations = false;
+#endif
+
+// Fixed-size objects carved out of slabs of SlabSize. A released object goes on a
+// free list and is handed out again before a new slab is taken, so a steady-state
+// simulation does no heap traffic per object. Everything goes away with the pool;
+// objects are trivially destructible, so nothing has to be run for them.
+template <class T, size_t SlabSize = 4096>
+class Pool {
+private:
+    union Slot {
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> slabs;
+    Slot* free_list = nullptr;
+    size_t slab_used = SlabSize;
+    size_t live = 0;
+    size_t peak = 0;
+
+public:
+    static_assert(std::is_trivially_destructible<T>::value, "Pool does not run destructors");
+
+    template <class... Args>
+    T* create(Args&&... args) {
+        Slot* slot = free_list;
+        if (slot) {
+            free_list = slot->next;
+        } else {
+            if (slab_used == SlabSize) {
+                slabs.emplace_back(new Slot[SlabSize]);
+                slab_used = 0;
+            }
+            slot = &slabs.back()[slab_used++];
+        }
+        if (++live > peak) peak = live;
+        return new (slot->storage) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T* obj) {
+        Slot* slot = reinterpret_cast<Slot*>(obj);
+        slot->next = free_list;
+        free_list = slot;
+        live--;
+    }
+
+    size_t slab_count() const { return slabs.size(); }
+    size_t slab_size() const { return SlabSize; }
+    size_t peak_live() const { return peak; }
+};
 
 // Process States
 enum ProcessState {
@@ -22,36 +111,60 @@ struct EventComparator {
     bool operator()(Event* e1, Event* e2);
 };
 
-class Process {
-public:
-    int pid;
-    int arrival_time;
-    int total_cpu_time;
-    int cpu_burst;
-    int io_burst;
-    int static_priority;
-    int dynamic_priority;
-    
-    int finish_time;
-    int cpu_waiting_time;
-    int io_time;
-    int cpu_time_remaining;
-    int current_cpu_burst;  // Track remaining burst time
-    int state_ts;  // timestamp of last state change
-    ProcessState state;
-    
-    Process(int _pid, int at, int tc, int cb, int io) {
-        pid = _pid;
-        arrival_time = at;
-        total_cpu_time = tc;
-        cpu_burst = cb;
-        io_burst = io;
-        cpu_time_remaining = tc;
-        current_cpu_burst = 0;
-        static_priority = 0;  // Will be set using myrandom
-        dynamic_priority = 0;
-        state = STATE_CREATED;
-        finish_time = cpu_waiting_time = io_time = state_ts = 0;
+// Processes are named by their pid, their index in the ProcessTable
+typedef uint32_t Pid;
+static const Pid NO_PID = UINT32_MAX;
+
+// All processes, one array per field, indexed by pid. A transition touches a few
+// words in a handful of arrays, and the fields kept only for the report stay out
+// of the simulation's cache lines.
+struct ProcessTable {
+    // from the input, and the priority drawn for it
+    std::vector<int> arrival_time;
+    std::vector<int> total_cpu_time;
+    std::vector<int> cpu_burst;
+    std::vector<int> io_burst;
+    std::vector<int> static_priority;
+    
+    // simulation state
+    std::vector<int> dynamic_priority;
+    std::vector<int> cpu_time_remaining;
+    std::vector<int> current_cpu_burst;  // Track remaining burst time
+    std::vector<int> state_ts;  // timestamp of last state change
+    std::vector<uint8_t> state;  // ProcessState
+    std::vector<Event*> pending_event;  // the one future event of the process, if any
+    std::vector<Pid> next_ready;  // next in its priority level's FIFO (MultiLevelScheduler)
+    std::vector<uint16_t> core;  // the core whose runqueue it joins when ready
+    
+    // results
+    std::vector<int> finish_time;
+    std::vector<int> cpu_waiting_time;
+    std::vector<int> io_time;
+    
+    size_t size() const { return arrival_time.size(); }
+    
+    Pid add(int at, int tc, int cb, int io, int prio) {
+        arrival_time.push_back(at);
+        total_cpu_time.push_back(tc);
+        cpu_burst.push_back(cb);
+        io_burst.push_back(io);
+        static_priority.push_back(prio);
+        dynamic_priority.push_back(prio - 1);
+        cpu_time_remaining.push_back(tc);
+        current_cpu_burst.push_back(0);
+        state_ts.push_back(0);
+        state.push_back(STATE_CREATED);
+        pending_event.push_back(nullptr);
+        next_ready.push_back(NO_PID);
+        core.push_back(0);
+        finish_time.push_back(0);
+        cpu_waiting_time.push_back(0);
+        io_time.push_back(0);
+        return size() - 1;
+    }
+    
+    size_t bytes_per_process() const {
+        return 12 * sizeof(int) + sizeof(uint8_t) + sizeof(Event*) + sizeof(Pid) + sizeof(uint16_t);
     }
 };
 
@@ -66,47 +179,292 @@ enum Transition {
 class Event {
 public:
     int timestamp;
-    Process* process;
+    Pid pid;
     Transition transition;
+    // Where the EventQueue keeps it, maintained by the queue
+    int heap_index;      // HeapEventQueue: position in the heap
+    Event* prev;         // CalendarEventQueue: neighbours in the bucket
+    Event* next;
     
-    Event(int ts, Process* p, Transition trans) : 
-        timestamp(ts), process(p), transition(trans) {}
+    Event(int ts, Pid p, Transition trans) : 
+        timestamp(ts), pid(p), transition(trans), heap_index(-1), prev(nullptr), next(nullptr) {}
 };
 
 bool EventComparator::operator()(Event* e1, Event* e2) {
     if (e1->timestamp == e2->timestamp) {
-        if (e1->process && e2->process) {
-            return e1->process->pid > e2->process->pid;
-        }
-        return e1 > e2;
+        return e1->pid > e2->pid;
     }
     return e1->timestamp > e2->timestamp;
 }
 
-// Event Queue
+// Event Queue: pending events in EventComparator order. An event that is still
+// queued can be canceled or moved to another time, wherever it is in the queue.
 class EventQueue {
+public:
+    virtual ~EventQueue() {}
+    
+    virtual void add_event(Event* evt) = 0;
+    virtual Event* get_next_event() = 0;
+    virtual Event* peek() = 0;
+    // Take a pending event out of the queue; the caller owns it again
+    virtual void cancel(Event* evt) = 0;
+    // Move a pending event to another time (and transition)
+    virtual void reschedule(Event* evt, int timestamp, Transition transition) = 0;
+    virtual bool empty() const = 0;
+    virtual std::string get_name() = 0;
+};
+
+// A 4-ary min-heap. Every event knows its position in the heap, so cancel and
+// reschedule are O(log n) like add and remove.
+class HeapEventQueue final : public EventQueue {
 private:
-    std::priority_queue<Event*, std::vector<Event*>, EventComparator> events;
+    static const int ARITY = 4;
+    std::vector<Event*> heap;
+    EventComparator later;  // later(a, b): a fires after b
+    
+    void place(Event* evt, size_t i) {
+        heap[i] = evt;
+        evt->heap_index = i;
+    }
+    
+    void sift_up(size_t i) {
+        Event* evt = heap[i];
+        while (i > 0) {
+            size_t parent = (i - 1) / ARITY;
+            if (!later(heap[parent], evt)) break;
+            place(heap[parent], i);
+            i = parent;
+        }
+        place(evt, i);
+    }
+    
+    void sift_down(size_t i) {
+        Event* evt = heap[i];
+        size_t n = heap.size();
+        for (;;) {
+            size_t first = i * ARITY + 1;
+            if (first >= n) break;
+            size_t best = first;
+            size_t last = std::min(first + ARITY, n);
+            for (size_t c = first + 1; c < last; c++) {
+                if (later(heap[best], heap[c])) best = c;
+            }
+            if (!later(evt, heap[best])) break;
+            place(heap[best], i);
+            i = best;
+        }
+        place(evt, i);
+    }
+    
+    // after evt's key changed in place
+    void restore(size_t i) {
+        if (i > 0 && later(heap[(i - 1) / ARITY], heap[i])) {
+            sift_up(i);
+        } else {
+            sift_down(i);
+        }
+    }
     
 public:
-    void add_event(Event* evt) {
-        events.push(evt);
+    void add_event(Event* evt) override {
+        heap.push_back(evt);
+        sift_up(heap.size() - 1);
     }
     
-    Event* get_next_event() {
-        if (events.empty()) return nullptr;
-        Event* evt = events.top();
-        events.pop();
+    Event* get_next_event() override {
+        if (heap.empty()) return nullptr;
+        Event* evt = heap.front();
+        cancel(evt);
         return evt;
     }
     
-    Event* peek() {
-        if (events.empty()) return nullptr;
-        return events.top();
+    Event* peek() override {
+        if (heap.empty()) return nullptr;
+        return heap.front();
+    }
+    
+    void cancel(Event* evt) override {
+        size_t i = evt->heap_index;
+        Event* last = heap.back();
+        heap.pop_back();
+        evt->heap_index = -1;
+        if (last != evt) {
+            place(last, i);
+            restore(i);
+        }
+    }
+    
+    void reschedule(Event* evt, int timestamp, Transition transition) override {
+        evt->timestamp = timestamp;
+        evt->transition = transition;
+        restore(evt->heap_index);
     }
 
-    bool empty() const {
-        return events.empty();
+    bool empty() const override {
+        return heap.empty();
+    }
+    
+    std::string get_name() override {
+        return "heap";
+    }
+};
+
+// Calendar queue (R. Brown, CACM 1988): a ring of buckets, each a day of `width`
+// time units, holding its events in a list sorted in EventComparator order. A
+// year is the whole ring. Simulation time only moves forward and new events land
+// close to it, so the next event is almost always at the head of the current
+// day's bucket: add and remove are O(1) amortized. The ring doubles or halves as
+// the queue grows or shrinks, and the day length is re-estimated from the gaps
+// between the events about to fire.
+class CalendarEventQueue final : public EventQueue {
+private:
+    struct Bucket {
+        Event* head = nullptr;
+        Event* tail = nullptr;
+    };
+    
+    static const size_t MIN_BUCKETS = 16;
+    std::vector<Bucket> buckets;
+    size_t mask;                // buckets.size() - 1
+    long long width;            // time units per bucket
+    long long cursor;           // no queued event is earlier than this
+    size_t count;
+    EventComparator later;
+    std::vector<int> sample;    // scratch for resize
+    
+    Bucket& bucket_of(long long timestamp) {
+        return buckets[(timestamp / width) & mask];
+    }
+    
+    // Sorted insert; from the tail, since new events are mostly the latest
+    void link(Event* evt) {
+        Bucket& b = bucket_of(evt->timestamp);
+        Event* after = b.tail;
+        while (after && later(after, evt)) {
+            after = after->prev;
+        }
+        evt->prev = after;
+        evt->next = after ? after->next : b.head;
+        if (evt->next) {
+            evt->next->prev = evt;
+        } else {
+            b.tail = evt;
+        }
+        if (after) {
+            after->next = evt;
+        } else {
+            b.head = evt;
+        }
+    }
+    
+    void unlink(Event* evt) {
+        Bucket& b = bucket_of(evt->timestamp);
+        if (evt->prev) {
+            evt->prev->next = evt->next;
+        } else {
+            b.head = evt->next;
+        }
+        if (evt->next) {
+            evt->next->prev = evt->prev;
+        } else {
+            b.tail = evt->prev;
+        }
+        evt->prev = evt->next = nullptr;
+    }
+    
+    // The earliest event: walk the days of one year from the cursor, and if
+    // nothing falls into that year, take the earliest bucket head directly.
+    Event* find_min() {
+        if (count == 0) return nullptr;
+        long long day = cursor / width;
+        for (size_t i = 0; i <= mask; i++, day++) {
+            Event* head = buckets[day & mask].head;
+            if (head && head->timestamp < (day + 1) * width) {
+                cursor = head->timestamp;
+                return head;
+            }
+        }
+        Event* best = nullptr;
+        for (const Bucket& b : buckets) {
+            if (b.head && (!best || later(best, b.head))) best = b.head;
+        }
+        cursor = best->timestamp;
+        return best;
+    }
+    
+    void resize(size_t nbuckets) {
+        std::vector<Event*> all;
+        all.reserve(count);
+        for (const Bucket& b : buckets) {
+            for (Event* e = b.head; e; e = e->next) all.push_back(e);
+        }
+        
+        // Day length: three times the mean gap between the next events to fire,
+        // leaving out gaps far above the mean (Brown's estimate)
+        sample.clear();
+        for (Event* e : all) sample.push_back(e->timestamp);
+        size_t n = std::min<size_t>(sample.size(), 25);
+        if (n >= 2) {
+            std::partial_sort(sample.begin(), sample.begin() + n, sample.end());
+            double mean = double(sample[n - 1] - sample[0]) / (n - 1);
+            double sum = 0;
+            int gaps = 0;
+            for (size_t i = 1; i < n; i++) {
+                int gap = sample[i] - sample[i - 1];
+                if (gap <= 2 * mean) {
+                    sum += gap;
+                    gaps++;
+                }
+            }
+            width = std::max(1LL, (long long)(3 * (gaps ? sum / gaps : mean)));
+        }
+        
+        buckets.assign(nbuckets, Bucket());
+        mask = nbuckets - 1;
+        for (Event* e : all) link(e);
+    }
+    
+public:
+    CalendarEventQueue() : mask(0), width(1), cursor(0), count(0) {
+        buckets.resize(MIN_BUCKETS);
+        mask = MIN_BUCKETS - 1;
+    }
+    
+    void add_event(Event* evt) override {
+        if (evt->timestamp < cursor) cursor = evt->timestamp;
+        link(evt);
+        if (++count > 2 * buckets.size()) resize(2 * buckets.size());
+    }
+    
+    Event* get_next_event() override {
+        Event* evt = find_min();
+        if (evt) cancel(evt);
+        return evt;
+    }
+    
+    Event* peek() override {
+        return find_min();
+    }
+    
+    void cancel(Event* evt) override {
+        unlink(evt);
+        if (--count < buckets.size() / 2 && buckets.size() > MIN_BUCKETS) resize(buckets.size() / 2);
+    }
+    
+    void reschedule(Event* evt, int timestamp, Transition transition) override {
+        unlink(evt);
+        evt->timestamp = timestamp;
+        evt->transition = transition;
+        if (timestamp < cursor) cursor = timestamp;
+        link(evt);
+    }
+    
+    bool empty() const override {
+        return count == 0;
+    }
+    
+    std::string get_name() override {
+        return "calendar";
     }
 };
 
@@ -115,14 +473,19 @@ class Scheduler {
 protected:
     int quantum;
     int maxprio;
+    ProcessTable* procs;
     
 public:
-    Scheduler(int q = 10000, int mp = 4) : quantum(q), maxprio(mp) {}
+    Scheduler(int q = 10000, int mp = 4) : quantum(q), maxprio(mp), procs(nullptr) {}
     virtual ~Scheduler() {}
     
-    virtual void add_process(Process* p) = 0;
-    virtual Process* get_next_process() = 0;
-    virtual bool test_preempt(Process* p, Process* current_running, Event* next_event, int current_time) { 
+    void set_process_table(ProcessTable* table) { procs = table; }
+    
+    virtual void add_process(Pid p) = 0;
+    // NO_PID when nothing is ready
+    virtual Pid get_next_process() = 0;
+    // Should p, just made ready, take the CPU from current_running?
+    virtual bool test_preempt(Pid p, Pid current_running, int current_time) { 
     return false; 
 }
     virtual int get_quantum() { return quantum; }
@@ -132,23 +495,23 @@ public:
 };
 
 
-class FCFSScheduler : public Scheduler {
+class FCFSScheduler final : public Scheduler {
 private:
-    std::queue<Process*> runqueue;
+    std::queue<Pid> runqueue;
     
 public:
     FCFSScheduler() : Scheduler() {}
     
-    void add_process(Process* p) override {
+    void add_process(Pid p) override {
         runqueue.push(p);
     }
     
-    Process* get_next_process() override {
+    Pid get_next_process() override {
         if (runqueue.empty()) {
-            return nullptr;
+            return NO_PID;
         }
         
-        Process* next_process = runqueue.front();
+        Pid next_process = runqueue.front();
         runqueue.pop();
         
         return next_process;
@@ -163,23 +526,23 @@ public:
     
 }; 
 
-class LCFSScheduler : public Scheduler {
+class LCFSScheduler final : public Scheduler {
 private:
-    std::stack<Process*> runstack;  
+    std::stack<Pid> runstack;  
     
 public:
     LCFSScheduler() : Scheduler() {}
     
-    void add_process(Process* p) override {
+    void add_process(Pid p) override {
         runstack.push(p);
     }
     
-    Process* get_next_process() override {
+    Pid get_next_process() override {
         if (runstack.empty()) {
-            return nullptr;
+            return NO_PID;
         }
         
-        Process* next_process = runstack.top();
+        Pid next_process = runstack.top();
         runstack.pop();
         
         return next_process;
@@ -189,34 +552,83 @@ public:
         return "LCFS";
     }
 };
-class SRTFScheduler : public Scheduler {
+// Shortest remaining time first, ties to the lower pid: the order of the SRTF
+// runqueue (and of the std::priority_queue it used to be, kept for -b)
+struct SRTFComparator {
+    const ProcessTable* procs;
+    
+    bool operator()(Pid p1, Pid p2) const {
+        if (procs->cpu_time_remaining[p1] == procs->cpu_time_remaining[p2]) {
+            return p1 > p2;
+        }
+        return procs->cpu_time_remaining[p1] > procs->cpu_time_remaining[p2];
+    }
+};
+
+// 4-ary min-heap in SRTFComparator order. Each entry is its key, remaining time
+// and pid packed into one integer, so sifting compares 8-byte entries (a parent's
+// four children in half a cache line) and never looks at the process table. A
+// process does not change while it waits, so its key stays valid.
+class SRTFRunqueue {
 private:
-    struct SRTFComparator {
-        bool operator()(const Process* p1, const Process* p2) const {
-            if (p1->cpu_time_remaining == p2->cpu_time_remaining) {
-                return p1->pid > p2->pid;
+    static const size_t ARITY = 4;
+    std::vector<uint64_t> heap;  // cpu_time_remaining << 32 | pid
+    
+public:
+    void push(int remaining, Pid p) {
+        uint64_t key = (uint64_t)(uint32_t)remaining << 32 | p;
+        size_t i = heap.size();
+        heap.push_back(key);
+        while (i > 0) {
+            size_t parent = (i - 1) / ARITY;
+            if (heap[parent] <= key) break;
+            heap[i] = heap[parent];
+            i = parent;
+        }
+        heap[i] = key;
+    }
+    
+    Pid pop() {
+        if (heap.empty()) return NO_PID;
+        Pid top = (Pid)heap[0];
+        uint64_t key = heap.back();
+        heap.pop_back();
+        size_t n = heap.size();
+        if (n == 0) return top;
+        
+        size_t i = 0;
+        for (;;) {
+            size_t first = i * ARITY + 1;
+            if (first >= n) break;
+            size_t best = first;
+            size_t last = std::min(first + ARITY, n);
+            for (size_t c = first + 1; c < last; c++) {
+                if (heap[c] < heap[best]) best = c;
             }
-            return p1->cpu_time_remaining > p2->cpu_time_remaining;
+            if (key <= heap[best]) break;
+            heap[i] = heap[best];
+            i = best;
         }
-    };
+        heap[i] = key;
+        return top;
+    }
     
-    std::priority_queue<Process*, std::vector<Process*>, SRTFComparator> runqueue;
+    bool empty() const { return heap.empty(); }
+};
+
+class SRTFScheduler final : public Scheduler {
+private:
+    SRTFRunqueue runqueue;
     
 public:
     SRTFScheduler() : Scheduler() {}
     
-    void add_process(Process* p) override {
-        runqueue.push(p);
+    void add_process(Pid p) override {
+        runqueue.push(procs->cpu_time_remaining[p], p);
     }
     
-    Process* get_next_process() override {
-        if (runqueue.empty()) {
-            return nullptr;
-        }
-        
-        Process* next_process = runqueue.top();
-        runqueue.pop();
-        return next_process;
+    Pid get_next_process() override {
+        return runqueue.pop();
     }
     
     std::string get_name() override {
@@ -225,9 +637,9 @@ public:
      
 };
 
-class RRScheduler : public Scheduler {
+class RRScheduler final : public Scheduler {
 private:
-    std::queue<Process*> runqueue;
+    std::queue<Pid> runqueue;
     
 public:
     RRScheduler(int quantum) : Scheduler(quantum) {
@@ -236,23 +648,23 @@ public:
         }
     }
     
-    void add_process(Process* p) override {
-        p->dynamic_priority = p->static_priority - 1;
+    void add_process(Pid p) override {
+        procs->dynamic_priority[p] = procs->static_priority[p] - 1;
         
         runqueue.push(p);
     }
     
-    Process* get_next_process() override {
+    Pid get_next_process() override {
         if (runqueue.empty()) {
-            return nullptr;
+            return NO_PID;
         }
         
-        Process* next = runqueue.front();
+        Pid next = runqueue.front();
         runqueue.pop();
         return next;
     }
     
-    bool test_preempt(Process* p, Process* current_running, Event* next_event, int current_time) override {
+    bool test_preempt(Pid p, Pid current_running, int current_time) override {
         return false;
     }
     
@@ -261,79 +673,145 @@ public:
     }
 };
 
-class PrioScheduler : public Scheduler {
+// Set of non-empty priority levels: a bit per level, and a summary bit per
+// 64-level word, so the highest level is found with two count-leading-zeros for
+// up to 4096 levels (and one more summary word per 4096 beyond that).
+class LevelBitmap {
 private:
-    struct QueueLevel {
-        std::queue<Process*> processes;
-    };
-    
-    std::vector<QueueLevel> activeQ;    
-    std::vector<QueueLevel> expiredQ;  
+    std::vector<uint64_t> words;
+    std::vector<uint64_t> summary;
+    int count;  // levels set
     
 public:
-    PrioScheduler(int quantum, int maxprio = 4) : Scheduler(quantum, maxprio) {
-        activeQ.resize(maxprio);
-        expiredQ.resize(maxprio);
+    explicit LevelBitmap(int levels) :
+        words((levels + 63) / 64), summary((levels + 4095) / 4096), count(0) {}
+    
+    // only for a level that is not set yet
+    void set(int level) {
+        words[level >> 6] |= 1ull << (level & 63);
+        summary[level >> 12] |= 1ull << ((level >> 6) & 63);
+        count++;
     }
     
-    void add_process(Process* p) override {
-        if (p->dynamic_priority < 0) {
-            p->dynamic_priority = p->static_priority - 1;
-            expiredQ[p->dynamic_priority].processes.push(p);
-        } else {
-            activeQ[p->dynamic_priority].processes.push(p);
+    // only for a level that is set
+    void clear(int level) {
+        uint64_t& word = words[level >> 6];
+        word &= ~(1ull << (level & 63));
+        if (word == 0) {
+            summary[level >> 12] &= ~(1ull << ((level >> 6) & 63));
         }
+        count--;
     }
     
-    Process* get_next_process() override {
-        for (int prio = maxprio - 1; prio >= 0; prio--) {
-            if (!activeQ[prio].processes.empty()) {
-                Process* next = activeQ[prio].processes.front();
-                activeQ[prio].processes.pop();
-                return next;
+    bool empty() const { return count == 0; }
+    
+    int highest() const {
+        for (int s = summary.size() - 1; s >= 0; s--) {
+            if (summary[s]) {
+                int w = s * 64 + 63 - __builtin_clzll(summary[s]);
+                return w * 64 + 63 - __builtin_clzll(words[w]);
             }
         }
+        return -1;
+    }
+};
+
+// The active and expired priority levels shared by PRIO and PREPRIO. Each level
+// is a FIFO linked through ProcessTable::next_ready, and a bitmap of the non-empty
+// levels picks the highest one; swapping active and expired flips an index.
+class MultiLevelScheduler : public Scheduler {
+private:
+    struct QueueLevel {
+        Pid head = NO_PID;
+        Pid tail = NO_PID;
+    };
+    
+    struct LevelArray {
+        std::vector<QueueLevel> levels;
+        LevelBitmap nonempty;
         
-        if (has_expired_processes()) {
-            activeQ.swap(expiredQ);
-            for (int prio = maxprio - 1; prio >= 0; prio--) {
-                if (!activeQ[prio].processes.empty()) {
-                    Process* next = activeQ[prio].processes.front();
-                    activeQ[prio].processes.pop();
-                    return next;
-                }
+        explicit LevelArray(int maxprio) : levels(maxprio), nonempty(maxprio) {}
+        
+        void push(std::vector<Pid>& next_ready, Pid p, int prio) {
+            QueueLevel& level = levels[prio];
+            next_ready[p] = NO_PID;
+            if (level.tail != NO_PID) {
+                next_ready[level.tail] = p;
+            } else {
+                level.head = p;
+                nonempty.set(prio);
             }
+            level.tail = p;
         }
         
-        return nullptr;
+        Pid pop_highest(const std::vector<Pid>& next_ready) {
+            int prio = nonempty.highest();
+            if (prio < 0) return NO_PID;
+            QueueLevel& level = levels[prio];
+            Pid p = level.head;
+            level.head = next_ready[p];
+            if (level.head == NO_PID) {
+                level.tail = NO_PID;
+                nonempty.clear(prio);
+            }
+            return p;
+        }
+    };
+    
+    LevelArray queues[2];
+    int active;  // queues[active] is the active array, the other the expired one
+    
+    LevelArray& activeQ() { return queues[active]; }
+    LevelArray& expiredQ() { return queues[active ^ 1]; }
+    
+public:
+    MultiLevelScheduler(int quantum, int maxprio) : Scheduler(quantum, maxprio),
+        queues{LevelArray(maxprio), LevelArray(maxprio)}, active(0) {}
+    
+    void add_process(Pid p) override {
+        int& prio = procs->dynamic_priority[p];
+        if (prio < 0) {
+            prio = procs->static_priority[p] - 1;
+            expiredQ().push(procs->next_ready, p, prio);
+        } else {
+            activeQ().push(procs->next_ready, p, prio);
+        }
     }
     
-    bool has_expired_processes() const {
-        for (const auto& level : expiredQ) {
-            if (!level.processes.empty()) {
-                return true;
-            }
+    Pid get_next_process() override {
+        if (activeQ().nonempty.empty()) {
+            active ^= 1;
         }
-        return false;
+        return activeQ().pop_highest(procs->next_ready);
+    }
+    
+    bool has_expired_processes() const {
+        return !queues[active ^ 1].nonempty.empty();
     }
+};
+
+class PrioScheduler final : public MultiLevelScheduler {
+public:
+    PrioScheduler(int quantum, int maxprio = 4) : MultiLevelScheduler(quantum, maxprio) {}
     
     std::string get_name() override {
         return "PRIO " + std::to_string(quantum);
     }
 };
 
-class PrePrioScheduler : public PrioScheduler {
+class PrePrioScheduler final : public MultiLevelScheduler {
 public:
-    PrePrioScheduler(int quantum, int maxprio = 4) : PrioScheduler(quantum, maxprio) {}
+    PrePrioScheduler(int quantum, int maxprio = 4) : MultiLevelScheduler(quantum, maxprio) {}
     
-    bool test_preempt(Process* p, Process* current_running, Event* next_event, int current_time) override {
-        if (!current_running) {
+    bool test_preempt(Pid p, Pid current_running, int current_time) override {
+        if (current_running == NO_PID) {
             return false;
         }
         
-        if (p->dynamic_priority > current_running->dynamic_priority) {
-            // Check if there's a pending event at the current time
-            if (next_event && next_event->timestamp == current_time) {
+        if (procs->dynamic_priority[p] > procs->dynamic_priority[current_running]) {
+            // Not if the running process leaves the CPU at this time anyway
+            Event* pending = procs->pending_event[current_running];
+            if (pending && pending->timestamp == current_time) {
                 return false;
             }
             return true;
@@ -346,47 +824,71 @@ public:
     }
 };
 
-// Discrete Event Simulator
+// Discrete Event Simulator. Policy and Queue are the scheduler and event queue
+// classes; with concrete (final) ones every call in the loop is resolved at compile
+// time, with Scheduler and EventQueue themselves every call goes through the vtable.
+//
+// Each core has its own scheduler instance, so its own runqueue, and its own
+// running process. A new process joins the least loaded core, and one back from
+// IO the core it last ran on. An idle core with nothing ready steals the next
+// process of the core with the most waiting, which then starts migration_cost
+// later (waiting in READY meanwhile).
+template <class Policy, class Queue>
 class DES_Layer {
 private:
+    struct Core {
+        Policy* scheduler;
+        Pid running = NO_PID;   // dispatched: TRANS_TO_RUN queued or running
+        int queued = 0;         // processes in its runqueue
+        long long busy = 0;     // cpu time given to processes
+        long dispatches = 0;
+        long steals = 0;
+    };
+    
     int CURRENT_TIME;
-    EventQueue event_queue;
-    Scheduler* scheduler;
-    Process* CURRENT_RUNNING_PROCESS;
+    Queue* event_queue;
+    std::vector<Core> cores;
+    int migration_cost;
     bool CALL_SCHEDULER;
-    std::vector<Process*> processes;
+    ProcessTable procs;
     std::vector<int> randvals;
     int rand_index;
     bool verbose;
     int processes_in_io;
     int total_cpu_time;
     int total_io_time;
+    long events_processed;
+    Pool<Event> event_pool;         // every pending event
     
     int get_next_event_time() {
-        Event* next = event_queue.peek();
+        Event* next = event_queue->peek();
         return next ? next->timestamp : -1;
     }
-    
-    void update_waiting_time(Process* proc, int time_in_state) {
-        if (proc->state == STATE_READY) {
-            proc->cpu_waiting_time += time_in_state;
-        }
-    }
 
 public:
     DES_Layer() : 
         CURRENT_TIME(0),
-        scheduler(nullptr),
-        CURRENT_RUNNING_PROCESS(nullptr),
+        event_queue(nullptr),
+        migration_cost(0),
         CALL_SCHEDULER(false),
         rand_index(0),
         verbose(false),
         processes_in_io(0),
         total_cpu_time(0),
-        total_io_time(0) {}
+        total_io_time(0),
+        events_processed(0) {}
 
     void set_verbose(bool v) { verbose = v; }
-    void set_scheduler(Scheduler* s) { scheduler = s; }  
+    // one scheduler per core
+    void set_schedulers(const std::vector<Policy*>& schedulers) {
+        cores.assign(schedulers.size(), Core());
+        for (size_t c = 0; c < cores.size(); c++) {
+            cores[c].scheduler = schedulers[c];
+            cores[c].scheduler->set_process_table(&procs);
+        }
+    }  
+    void set_migration_cost(int cost) { migration_cost = cost; }
+    void set_event_queue(Queue* q) { event_queue = q; }
     
     int myrandom(int burst) {
         if (rand_index >= randvals.size()) {
@@ -426,13 +928,11 @@ public:
             exit(1);
         }
 
-        int pid = 0;
         int at, tc, cb, io;
         
         while (infile >> at >> tc >> cb >> io) {
-            Process* proc = new Process(pid, at, tc, cb, io);
-            proc->static_priority = myrandom(scheduler->get_max_prio());
-            proc->dynamic_priority = proc->static_priority - 1;
+            int prio = myrandom(cores[0].scheduler->get_max_prio());
+            Pid pid = procs.add(at, tc, cb, io, prio);
             
             if (verbose) {
                 std::cout << "Read process " << pid << ": "
@@ -440,38 +940,95 @@ public:
                          << " total_cpu=" << tc
                          << " cpu_burst=" << cb
                          << " io_burst=" << io
-                         << " prio=" << proc->static_priority << std::endl;
+                         << " prio=" << prio << std::endl;
             }
             
-            processes.push_back(proc);
-            add_event(at, proc, TRANS_TO_READY);
-            pid++;
+            add_event(at, pid, TRANS_TO_READY);
         }
 
         infile.close();
     }
 
-    void add_event(int timestamp, Process* proc, Transition trans) {
-        Event* evt = new Event(timestamp, proc, trans);
+    void add_event(int timestamp, Pid pid, Transition trans) {
+        Event* evt = event_pool.create(timestamp, pid, trans);
         if (verbose) {
             std::cout << "Event added: time=" << timestamp 
-                     << " pid=" << proc->pid 
+                     << " pid=" << pid 
                      << " transition=" << trans << std::endl;
         }
-        event_queue.add_event(evt);
+        procs.pending_event[pid] = evt;
+        event_queue->add_event(evt);
+    }
+
+    void reschedule_event(Event* evt, int timestamp, Transition trans) {
+        if (verbose) {
+            std::cout << "Event rescheduled: time=" << evt->timestamp << "->" << timestamp
+                     << " pid=" << evt->pid 
+                     << " transition=" << trans << std::endl;
+        }
+        event_queue->reschedule(evt, timestamp, trans);
+    }
+
+    // Where a process that becomes ready queues: its last core, or if it is new,
+    // the one with the fewest processes waiting or running
+    int ready_core(Pid proc) {
+        if (procs.state[proc] != STATE_CREATED) {
+            return procs.core[proc];
+        }
+        int best = 0;
+        for (int c = 1; c < (int)cores.size(); c++) {
+            if (cores[c].queued + (cores[c].running != NO_PID) <
+                cores[best].queued + (cores[best].running != NO_PID)) {
+                best = c;
+            }
+        }
+        return best;
+    }
+    
+    void make_ready(Pid proc, int c) {
+        procs.core[proc] = c;
+        cores[c].queued++;
+        cores[c].scheduler->add_process(proc);
+    }
+    
+    // An idle core runs the next process of its own runqueue, or else steals
+    // the next one of the core with the most waiting
+    void dispatch(int c) {
+        Core& core = cores[c];
+        int start = CURRENT_TIME;
+        Pid proc = core.queued ? core.scheduler->get_next_process() : NO_PID;
+        if (proc != NO_PID) {
+            core.queued--;
+        } else {
+            int victim = -1;
+            for (int v = 0; v < (int)cores.size(); v++) {
+                if (cores[v].queued > 0 && (victim < 0 || cores[v].queued > cores[victim].queued)) {
+                    victim = v;
+                }
+            }
+            if (victim < 0) return;
+            proc = cores[victim].scheduler->get_next_process();
+            cores[victim].queued--;
+            procs.core[proc] = c;
+            core.steals++;
+            start += migration_cost;
+        }
+        core.running = proc;
+        core.dispatches++;
+        add_event(start, proc, TRANS_TO_RUN);
     }
 
     void run_simulation() {
         Event* evt;
         int last_time = 0;
 
-        while ((evt = event_queue.get_next_event())) {
-            Process* proc = evt->process;
+        while ((evt = event_queue->get_next_event())) {
+            Pid proc = evt->pid;
             
             CURRENT_TIME = evt->timestamp;
-            int timeInPrevState = CURRENT_TIME - proc->state_ts;
-            if (proc->state == STATE_READY) {
-                proc->cpu_waiting_time += timeInPrevState;
+            int timeInPrevState = CURRENT_TIME - procs.state_ts[proc];
+            if (procs.state[proc] == STATE_READY) {
+                procs.cpu_waiting_time[proc] += timeInPrevState;
             }
             
             if (processes_in_io > 0) {
@@ -481,110 +1038,109 @@ public:
             
             if (verbose) {
                 std::cout << "Current Time: " << CURRENT_TIME 
-                         << " Process: " << proc->pid 
+                         << " Process: " << proc 
                          << " Previous state time: " << timeInPrevState << std::endl;
             }
             
             Transition transition = evt->transition;
-            delete evt;
+            procs.pending_event[proc] = nullptr;
+            event_pool.destroy(evt);
+            events_processed++;
             
             switch(transition) {
                 case TRANS_TO_READY: {
-                    if (proc->state == STATE_BLOCKED) {
-                        proc->io_time += timeInPrevState;
+                    int c = ready_core(proc);
+                    if (procs.state[proc] == STATE_BLOCKED) {
+                        procs.io_time[proc] += timeInPrevState;
                         processes_in_io--;
-                        proc->dynamic_priority = proc->static_priority - 1;
+                        procs.dynamic_priority[proc] = procs.static_priority[proc] - 1;
                     }
                     
-                    proc->state = STATE_READY;
-                    proc->state_ts = CURRENT_TIME;
-
-                    Event* next_event = event_queue.peek();
-                    if (CURRENT_RUNNING_PROCESS && 
-                        scheduler->test_preempt(proc, CURRENT_RUNNING_PROCESS, next_event, CURRENT_TIME)) {
-                        if (next_event && next_event->process == CURRENT_RUNNING_PROCESS) {
-                            event_queue.get_next_event();  // Remove the event
-                            delete next_event;
+                    procs.state[proc] = STATE_READY;
+                    procs.state_ts[proc] = CURRENT_TIME;
+
+                    Pid running = cores[c].running;
+                    if (running != NO_PID && procs.state[running] == STATE_RUNNING &&
+                        cores[c].scheduler->test_preempt(proc, running, CURRENT_TIME)) {
+                        // Its future BLOCK or PREEMPT becomes a PREEMPT now, wherever it is queued
+                        Event* pending = procs.pending_event[running];
+                        if (pending) {
+                            reschedule_event(pending, CURRENT_TIME, TRANS_TO_PREEMPT);
+                        } else {
+                            add_event(CURRENT_TIME, running, TRANS_TO_PREEMPT);
                         }
-                        
-                        add_event(CURRENT_TIME, CURRENT_RUNNING_PROCESS, TRANS_TO_PREEMPT);
                     }
 
-                    scheduler->add_process(proc);
+                    make_ready(proc, c);
                     CALL_SCHEDULER = true;
                     break;
                 }
                 
                 case TRANS_TO_RUN: {
-                    proc->state = STATE_RUNNING;
-                    proc->state_ts = CURRENT_TIME;
+                    procs.state[proc] = STATE_RUNNING;
+                    procs.state_ts[proc] = CURRENT_TIME;
                     
-                    if (proc->current_cpu_burst == 0) {
-                        proc->current_cpu_burst = myrandom(proc->cpu_burst);
-                        if (proc->current_cpu_burst > proc->cpu_time_remaining) {
-                            proc->current_cpu_burst = proc->cpu_time_remaining;
+                    int& burst = procs.current_cpu_burst[proc];
+                    if (burst == 0) {
+                        burst = myrandom(procs.cpu_burst[proc]);
+                        if (burst > procs.cpu_time_remaining[proc]) {
+                            burst = procs.cpu_time_remaining[proc];
                         }
                     }
                     
-                    int quantum = scheduler->get_quantum();
-                    int remaining_burst = proc->current_cpu_burst;
+                    int quantum = cores[procs.core[proc]].scheduler->get_quantum();
+                    int remaining_burst = burst;
     
-                    if (dynamic_cast<RRScheduler*>(scheduler)) {
-                        if (remaining_burst > quantum) {
-                            add_event(CURRENT_TIME + quantum, proc, TRANS_TO_PREEMPT);
-                        } else {
-                            add_event(CURRENT_TIME + remaining_burst, proc, TRANS_TO_BLOCK);
-                        }
+                    if (remaining_burst > quantum) {
+                        add_event(CURRENT_TIME + quantum, proc, TRANS_TO_PREEMPT);
                     } else {
-                        if (remaining_burst > quantum) {
-                            add_event(CURRENT_TIME + quantum, proc, TRANS_TO_PREEMPT);
-                        } else {
-                            add_event(CURRENT_TIME + remaining_burst, proc, TRANS_TO_BLOCK);
-                        }
+                        add_event(CURRENT_TIME + remaining_burst, proc, TRANS_TO_BLOCK);
                     }
                     break;
                 }
                 
                 case TRANS_TO_BLOCK: {
+                    Core& core = cores[procs.core[proc]];
                     total_cpu_time += timeInPrevState;
-                    proc->cpu_time_remaining -= proc->current_cpu_burst;
-                    proc->current_cpu_burst = 0;
+                    core.busy += timeInPrevState;
+                    procs.cpu_time_remaining[proc] -= procs.current_cpu_burst[proc];
+                    procs.current_cpu_burst[proc] = 0;
                     
-                    if (proc->cpu_time_remaining <= 0) {
-                        proc->state = STATE_FINISHED;
-                        proc->finish_time = CURRENT_TIME;
+                    if (procs.cpu_time_remaining[proc] <= 0) {
+                        procs.state[proc] = STATE_FINISHED;
+                        procs.finish_time[proc] = CURRENT_TIME;
                     } else {
-                        proc->state = STATE_BLOCKED;
+                        procs.state[proc] = STATE_BLOCKED;
                         processes_in_io++;
-                        int io_burst = myrandom(proc->io_burst);
+                        int io_burst = myrandom(procs.io_burst[proc]);
                         add_event(CURRENT_TIME + io_burst, proc, TRANS_TO_READY);
                     }
                     
-                    proc->state_ts = CURRENT_TIME;
-                    CURRENT_RUNNING_PROCESS = nullptr;
+                    procs.state_ts[proc] = CURRENT_TIME;
+                    core.running = NO_PID;
                     CALL_SCHEDULER = true;
                     break;
                 }
                 
                 case TRANS_TO_PREEMPT: {
+                    Core& core = cores[procs.core[proc]];
                     total_cpu_time += timeInPrevState;
-                    proc->cpu_time_remaining -= timeInPrevState;
-                    proc->current_cpu_burst -= timeInPrevState;
+                    core.busy += timeInPrevState;
+                    procs.cpu_time_remaining[proc] -= timeInPrevState;
+                    procs.current_cpu_burst[proc] -= timeInPrevState;
                     
-                    proc->state = STATE_READY;
-                    proc->state_ts = CURRENT_TIME;
+                    procs.state[proc] = STATE_READY;
+                    procs.state_ts[proc] = CURRENT_TIME;
                     
-                    if (dynamic_cast<RRScheduler*>(scheduler)) {
-                        proc->dynamic_priority = proc->static_priority - 1;
-                    } else {
-                        proc->dynamic_priority--;
-                        if (proc->dynamic_priority < 0) {
-                            proc->dynamic_priority = proc->static_priority - 1;
-                        }
+                    // RR::add_process resets it to static_priority - 1 anyway
+                    int& prio = procs.dynamic_priority[proc];
+                    prio--;
+                    if (prio < 0) {
+                        prio = procs.static_priority[proc] - 1;
                     }
                     
-                    scheduler->add_process(proc);
-                    CURRENT_RUNNING_PROCESS = nullptr;
+                    core.running = NO_PID;
+                    make_ready(proc, procs.core[proc]);
                     CALL_SCHEDULER = true;
                     break;
                 }
@@ -596,10 +1152,9 @@ public:
                 }
                 
                 CALL_SCHEDULER = false;
-                if (CURRENT_RUNNING_PROCESS == nullptr) {
-                    CURRENT_RUNNING_PROCESS = scheduler->get_next_process();
-                    if (CURRENT_RUNNING_PROCESS) {
-                        add_event(CURRENT_TIME, CURRENT_RUNNING_PROCESS, TRANS_TO_RUN);
+                for (int c = 0; c < (int)cores.size(); c++) {
+                    if (cores[c].running == NO_PID) {
+                        dispatch(c);
                     }
                 }
             }
@@ -607,38 +1162,49 @@ public:
     }
 
     void print_statistics() {
-        std::cout << scheduler->get_name() << std::endl;
-
-        for (Process* proc : processes) {
-            printf("%04d: %4d %4d %4d %4d %1d | %5d %5d %5d %5d\n",
-                proc->pid,
-                proc->arrival_time,
-                proc->total_cpu_time,
-                proc->cpu_burst,
-                proc->io_burst,
-                proc->static_priority,
-                proc->finish_time,
-                proc->finish_time - proc->arrival_time,  // turnaround time
-                proc->io_time,
-                proc->cpu_waiting_time
+        std::cout << cores[0].scheduler->get_name() << std::endl;
+
+        size_t n = procs.size();
+        for (size_t pid = 0; pid < n; pid++) {
+            printf("%04zu: %4d %4d %4d %4d %1d | %5d %5d %5d %5d\n",
+                pid,
+                procs.arrival_time[pid],
+                procs.total_cpu_time[pid],
+                procs.cpu_burst[pid],
+                procs.io_burst[pid],
+                procs.static_priority[pid],
+                procs.finish_time[pid],
+                procs.finish_time[pid] - procs.arrival_time[pid],  // turnaround time
+                procs.io_time[pid],
+                procs.cpu_waiting_time[pid]
             );
         }
 
+        // Plain loops over the columns with integer sums (exact, so the same as
+        // summing in double), which the compiler vectorizes (-O3)
+        const int* finish = procs.finish_time.data();
+        const int* arrival = procs.arrival_time.data();
+        const int* wait = procs.cpu_waiting_time.data();
         int last_finish_time = 0;
-        double total_turnaround = 0;
-        double total_cpu_wait = 0;
+        long long total_turnaround = 0;
+        long long total_cpu_wait = 0;
         
-        for (Process* proc : processes) {
-            last_finish_time = std::max(last_finish_time, proc->finish_time);
-            total_turnaround += (proc->finish_time - proc->arrival_time);
-            total_cpu_wait += proc->cpu_waiting_time;
+        for (size_t i = 0; i < n; i++) {
+            last_finish_time = std::max(last_finish_time, finish[i]);
+        }
+        for (size_t i = 0; i < n; i++) {
+            total_turnaround += finish[i] - arrival[i];
+        }
+        for (size_t i = 0; i < n; i++) {
+            total_cpu_wait += wait[i];
         }
 
-        double cpu_util = (total_cpu_time * 100.0) / last_finish_time;
+        // of the whole machine; the same as before on a single core
+        double cpu_util = (total_cpu_time * 100.0) / ((double)last_finish_time * cores.size());
         double io_util = (total_io_time * 100.0) / last_finish_time;
-        double avg_turnaround = total_turnaround / processes.size();
-        double avg_cpu_wait = total_cpu_wait / processes.size();
-        double throughput = (processes.size() * 100.0) / last_finish_time;
+        double avg_turnaround = (double)total_turnaround / n;
+        double avg_cpu_wait = (double)total_cpu_wait / n;
+        double throughput = (n * 100.0) / last_finish_time;
 
         printf("SUM: %d %.2lf %.2lf %.2lf %.2lf %.3lf\n",
             last_finish_time,
@@ -648,17 +1214,68 @@ public:
             avg_cpu_wait,
             throughput
         );
+        
+        if (cores.size() > 1) {
+            print_core_statistics(last_finish_time);
+        }
+    }
+    
+    // -c: how busy each core was, how often it dispatched and how many of those
+    // it stole, and the load imbalance: how far the busiest core is above the mean
+    void print_core_statistics(int last_finish_time) {
+        long long max_busy = 0;
+        long long total_busy = 0;
+        long steals = 0;
+        for (size_t c = 0; c < cores.size(); c++) {
+            const Core& core = cores[c];
+            printf("CPU %zu: %.2lf %ld %ld\n", c, (core.busy * 100.0) / last_finish_time,
+                core.dispatches, core.steals);
+            max_busy = std::max(max_busy, core.busy);
+            total_busy += core.busy;
+            steals += core.steals;
+        }
+        double mean_busy = (double)total_busy / cores.size();
+        printf("IMBALANCE: %.2lf %ld\n", mean_busy > 0 ? (max_busy / mean_busy - 1) * 100.0 : 0.0, steals);
+    }
+
+    // -T: simulation speed and where the memory came from, on stderr
+    void print_report(double sim_ms, size_t setup_allocations, size_t sim_allocations) {
+        fprintf(stderr, "simulation: %ld events in %.2f ms (%.0f events/s, %s queue)\n",
+            events_processed, sim_ms, sim_ms > 0 ? events_processed * 1000.0 / sim_ms : 0.0,
+            event_queue->get_name().c_str());
+        fprintf(stderr, "event pool: %zu slabs of %zu, %zu events live at peak\n",
+            event_pool.slab_count(), event_pool.slab_size(), event_pool.peak_live());
+        fprintf(stderr, "process table: %zu processes, %zu bytes each\n",
+            procs.size(), procs.bytes_per_process());
+        if (counting_allocations) {
+            fprintf(stderr, "heap allocations: %zu in setup, %zu during simulation (%.4f per event)\n",
+                setup_allocations, sim_allocations,
+                events_processed ? (double)sim_allocations / events_processed : 0.0);
+        } else {
+            fprintf(stderr, "heap allocations: not counted (build with -DCOUNT_ALLOCATIONS)\n");
+        }
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        fprintf(stderr, "memory: %ld KB peak RSS\n", usage.ru_maxrss);
     }
 };
 
 
 void show_usage() {
-    std::cout << "Usage: ./sched [-vh] [-t] [-e] [-p] [-s<schedspec>] inputfile randfile\n";
+    std::cout << "Usage: ./sched [-vh] [-t] [-e] [-p] [-T] [-V] [-q<queue>] [-c<cores>] [-m<cost>] [-s<schedspec>] inputfile randfile\n";
     std::cout << "  -v: verbose output\n";
     std::cout << "  -h: show this help\n";
     std::cout << "  -t: trace scheduler events\n";
     std::cout << "  -e: show eventQ before/after\n";
     std::cout << "  -p: show preemption decisions\n";
+    std::cout << "  -q queue: event queue, heap (default) or calendar\n";
+    std::cout << "  -T: report simulation time and memory to stderr (allocations with -DCOUNT_ALLOCATIONS)\n";
+    std::cout << "  -b sizes: benchmark the SRTF runqueue with this many ready processes, e.g. 1k,100k,1M\n";
+    std::cout << "  -c cores: simulate this many cores, each with its own runqueue (default 1);\n";
+    std::cout << "            adds a line per core (CPU <n>: util dispatches steals) and\n";
+    std::cout << "            IMBALANCE: <busiest core over the mean, in %> <steals> after SUM\n";
+    std::cout << "  -m cost: time a process stolen by an idle core waits before it runs (default 0)\n";
+    std::cout << "  -V: run the simulation through the virtual scheduler and queue interfaces\n";
     std::cout << "  -s schedspec: scheduler specification\n";
     std::cout << "    F|FCFS : First Come First Served\n";
     std::cout << "    L|LCFS : Last Come First Served\n";
@@ -669,22 +1286,130 @@ void show_usage() {
     exit(1);
 }
 
-Scheduler* create_scheduler(const std::string& spec) {
+// -b: push/pop throughput of the SRTF runqueue against a std::priority_queue of
+// pids ordered by SRTFComparator, which reads the process table on every compare.
+// Each size is filled with that many ready processes in random order, then runs
+// one pop and one push per process for a few rounds (the popped process comes back
+// with less time remaining, or as a new arrival once done), then drains. Both
+// queues see the same sequence, and the order they pop in is checked to be the same.
+template <class Queue, class Push, class Pop>
+double time_runqueue(Queue& queue, Push push, Pop pop, ProcessTable& procs,
+                     const std::vector<Pid>& arrivals, const std::vector<int>& work, uint64_t& order) {
+    procs.cpu_time_remaining = procs.total_cpu_time;
+    auto start = std::chrono::steady_clock::now();
+    for (Pid p : arrivals) {
+        push(queue, p);
+    }
+    for (int w : work) {
+        Pid p = pop(queue);
+        order = order * 31 + p;
+        int& remaining = procs.cpu_time_remaining[p];
+        remaining -= w;
+        if (remaining <= 0) {
+            remaining = procs.total_cpu_time[p];
+        }
+        push(queue, p);
+    }
+    for (size_t i = 0; i < arrivals.size(); i++) {
+        order = order * 31 + pop(queue);
+    }
+    std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - start;
+    return ns.count();
+}
+
+void bench_runqueue(const std::string& sizes) {
+    printf("%10s %12s %14s %14s %8s\n", "ready", "ops", "pq Mops/s", "4-ary Mops/s", "speedup");
+    for (const char* ptr = sizes.c_str(); *ptr; ) {
+        char* end;
+        long n = strtol(ptr, &end, 10);
+        if (*end == 'k' || *end == 'K') n *= 1000, end++;
+        if (*end == 'm' || *end == 'M') n *= 1000000, end++;
+        if (n <= 0 || (*end && *end != ',')) {
+            std::cerr << "Error: Invalid runqueue sizes: " << sizes << std::endl;
+            exit(1);
+        }
+        ptr = *end ? end + 1 : end;
+        
+        uint64_t state = n;
+        auto next = [&state]() {  // splitmix64
+            uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        };
+        ProcessTable procs;
+        std::vector<Pid> arrivals;
+        for (long i = 0; i < n; i++) {
+            arrivals.push_back(procs.add(0, 1 + next() % 10000, 0, 0, 1));
+        }
+        for (long i = n - 1; i > 0; i--) {
+            std::swap(arrivals[i], arrivals[next() % (i + 1)]);
+        }
+        std::vector<int> work(std::max(4 * n, 4000000L));
+        for (int& w : work) {
+            w = 1 + next() % 100;
+        }
+        
+        uint64_t pq_order = 0, heap_order = 0;
+        std::priority_queue<Pid, std::vector<Pid>, SRTFComparator> pq(SRTFComparator{&procs});
+        double pq_ns = time_runqueue(pq,
+            [](auto& q, Pid p) { q.push(p); },
+            [](auto& q) { Pid p = q.top(); q.pop(); return p; },
+            procs, arrivals, work, pq_order);
+        SRTFRunqueue heap;
+        double heap_ns = time_runqueue(heap,
+            [&procs](auto& q, Pid p) { q.push(procs.cpu_time_remaining[p], p); },
+            [](auto& q) { return q.pop(); },
+            procs, arrivals, work, heap_order);
+        if (pq_order != heap_order) {
+            std::cerr << "Error: runqueues disagree on the order for " << n << " processes\n";
+            exit(1);
+        }
+        
+        double ops = 2.0 * (n + work.size());
+        printf("%10ld %12.0f %14.1f %14.1f %7.2fx\n", n, ops, ops * 1000 / pq_ns, ops * 1000 / heap_ns, pq_ns / heap_ns);
+    }
+}
+
+// Builds the event queue for spec and hands it to run() as its own type
+template <class Run>
+void create_event_queue(const std::string& spec, Run&& run) {
+    if (spec == "heap") {
+        HeapEventQueue queue;
+        run(queue);
+        return;
+    } else if (spec == "calendar") {
+        CalendarEventQueue queue;
+        run(queue);
+        return;
+    }
+    std::cerr << "Error: Invalid event queue: " << spec << std::endl;
+    exit(1);
+}
+
+// Builds the scheduler for spec and hands it to run() as its own type, so the
+// simulation is compiled for each scheduler kind and dispatched here, once
+template <class Run>
+void create_scheduler(const std::string& spec, Run&& run) {
     if (spec.empty()) {
         std::cerr << "Error: Scheduler specification required\n";
         exit(1);
     }
 
     if (spec == "F" || spec == "FCFS") {
-        return new FCFSScheduler();
+        FCFSScheduler scheduler;
+        return run(scheduler);
     } else if (spec == "L" || spec == "LCFS") {
-        return new LCFSScheduler();
+        LCFSScheduler scheduler;
+        return run(scheduler);
     } else if (spec == "S" || spec == "SRTF") {
-        return new SRTFScheduler();
+        SRTFScheduler scheduler;
+        return run(scheduler);
     } else if (spec[0] == 'R') {
         int quantum;
         if (sscanf(spec.c_str() + 1, "%d", &quantum) == 1 && quantum > 0) {
-            return new RRScheduler(quantum);
+            RRScheduler scheduler(quantum);
+            return run(scheduler);
         }
     } else if (spec[0] == 'P') {
         int quantum, maxprio = 4;
@@ -695,7 +1420,8 @@ Scheduler* create_scheduler(const std::string& spec) {
             maxprio = atoi(ptr + 1);
         }
         if (quantum > 0 && maxprio > 0) {
-            return new PrioScheduler(quantum, maxprio);
+            PrioScheduler scheduler(quantum, maxprio);
+            return run(scheduler);
         }
     } else if (spec[0] == 'E') {  // Preemptive Priority
         int quantum, maxprio = 4;
@@ -706,7 +1432,8 @@ Scheduler* create_scheduler(const std::string& spec) {
             maxprio = atoi(ptr + 1);
         }
         if (quantum > 0 && maxprio > 0) {
-            return new PrePrioScheduler(quantum, maxprio);
+            PrePrioScheduler scheduler(quantum, maxprio);
+            return run(scheduler);
         }
     }
     
@@ -714,13 +1441,53 @@ Scheduler* create_scheduler(const std::string& spec) {
     exit(1);
 }
 
+template <class Policy, class Queue>
+void simulate(const std::vector<Policy*>& schedulers, Queue* event_queue, int migration_cost,
+              const std::string& input_file, const std::string& rand_file, bool verbose, bool report) {
+    DES_Layer<Policy, Queue> des;
+    des.set_schedulers(schedulers);
+    des.set_migration_cost(migration_cost);
+    des.set_event_queue(event_queue);
+    des.set_verbose(verbose);
+    
+    try {
+        des.read_rfile(rand_file);
+    } catch (const std::exception& e) {
+        std::cerr << "Error reading random number file: " << e.what() << std::endl;
+        exit(1);
+    }
+    
+    try {
+        des.read_input_file(input_file);
+    } catch (const std::exception& e) {
+        std::cerr << "Error reading input file: " << e.what() << std::endl;
+        exit(1);
+    }
+    
+    size_t setup_allocations = heap_allocations;
+    auto start = std::chrono::steady_clock::now();
+    des.run_simulation();
+    std::chrono::duration<double, std::milli> sim_ms = std::chrono::steady_clock::now() - start;
+    size_t sim_allocations = heap_allocations - setup_allocations;
+    
+    des.print_statistics();
+    if (report) {
+        des.print_report(sim_ms.count(), setup_allocations, sim_allocations);
+    }
+}
+
 int main(int argc, char* argv[]) {
     bool verbose = false;
+    bool report = false;
+    bool virtual_dispatch = false;
+    int ncores = 1;
+    int migration_cost = 0;
     std::string sched_spec;
+    std::string queue_spec = "heap";
     
     int c;
     opterr = 0; 
-    while ((c = getopt(argc, argv, "vhteps:")) != -1) {
+    while ((c = getopt(argc, argv, "vhtepTVs:q:b:c:m:")) != -1) {
         switch (c) {
             case 'v':
                 verbose = true;
@@ -734,12 +1501,42 @@ int main(int argc, char* argv[]) {
                 break;
             case 'p':  
                 break;
+            case 'T':
+                report = true;
+                break;
+            case 'V':
+                virtual_dispatch = true;
+                break;
             case 's':
                 sched_spec = optarg;
                 break;
+            case 'q':
+                queue_spec = optarg;
+                break;
+            case 'b':
+                bench_runqueue(optarg);
+                exit(0);
+            case 'c':
+                ncores = atoi(optarg);
+                if (ncores < 1 || ncores > 65535) {
+                    std::cerr << "Error: Invalid number of cores: " << optarg << std::endl;
+                    show_usage();
+                }
+                break;
+            case 'm':
+                migration_cost = atoi(optarg);
+                if (migration_cost < 0) {
+                    std::cerr << "Error: Invalid migration cost: " << optarg << std::endl;
+                    show_usage();
+                }
+                break;
             case '?':
                 if (optopt == 's')
                     std::cerr << "Option -s requires a scheduler specification.\n";
+                else if (optopt == 'q')
+                    std::cerr << "Option -q requires an event queue.\n";
+                else if (optopt == 'c' || optopt == 'm' || optopt == 'b')
+                    std::cerr << "Option -" << char(optopt) << " requires a number.\n";
                 else
                     std::cerr << "Unknown option: " << char(optopt) << std::endl;
                 show_usage();
@@ -762,35 +1559,22 @@ int main(int argc, char* argv[]) {
     std::string rand_file = argv[optind + 1];
 
     try {
-        DES_Layer des;
-        
-        Scheduler* scheduler = create_scheduler(sched_spec);
-        des.set_scheduler(scheduler);
-        
-        des.set_verbose(verbose);
-        
-        try {
-            des.read_rfile(rand_file);
-        } catch (const std::exception& e) {
-            std::cerr << "Error reading random number file: " << e.what() << std::endl;
-            delete scheduler;
-            exit(1);
-        }
-        
-        try {
-            des.read_input_file(input_file);
-        } catch (const std::exception& e) {
-            std::cerr << "Error reading input file: " << e.what() << std::endl;
-            delete scheduler;
-            exit(1);
-        }
-        
-        des.run_simulation();
-        
-        des.print_statistics();
-        
-        delete scheduler;
-        
+        create_event_queue(queue_spec, [&](auto& event_queue) {
+            create_scheduler(sched_spec, [&](auto& scheduler) {
+                // a runqueue per core: copies of the scheduler the spec built
+                std::vector<std::remove_reference_t<decltype(scheduler)>> per_core(ncores, scheduler);
+                if (virtual_dispatch) {
+                    std::vector<Scheduler*> schedulers;
+                    for (auto& s : per_core) schedulers.push_back(&s);
+                    simulate<Scheduler, EventQueue>(schedulers, &event_queue, migration_cost,
+                                                    input_file, rand_file, verbose, report);
+                } else {
+                    std::vector<decltype(&scheduler)> schedulers;
+                    for (auto& s : per_core) schedulers.push_back(&s);
+                    simulate(schedulers, &event_queue, migration_cost, input_file, rand_file, verbose, report);
+                }
+            });
+        });
     } catch (const std::exception& e) {
         std::cerr << "Error during simulation: " << e.what() << std::endl;
         return 1;